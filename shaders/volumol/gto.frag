@@ -3,12 +3,10 @@ out vec4 FragColor;
 
 in vec3 pos;
 
-#define PRIMITIVES 16
-
-uniform vec3[PRIMITIVES] exponents;
-uniform float[PRIMITIVES] alpha;
-uniform float[PRIMITIVES] coeff;
-uniform vec3[PRIMITIVES] origin;
+// Three texels per primitive: origin and exponent, powers of x, y and z, coefficient.
+uniform samplerBuffer primitives;
+uniform int first_primitive;
+uniform int primitive_count;
 
 float ipow(float f, int p) {
 	float r = 1.0;
@@ -18,9 +16,12 @@ float ipow(float f, int p) {
 
 void main() {
 	float psi = 0.0;
-	for (int i = 0; i < PRIMITIVES; ++i) {
-		vec3 r = pos - origin[i];
-		psi += coeff[i] * ipow(r.x, int(exponents[i].x)) * ipow(r.y, int(exponents[i].y)) * ipow(r.z, int(exponents[i].z)) * exp(-alpha[i] * dot(r, r));
+	for (int i = first_primitive; i < first_primitive + primitive_count; ++i) {
+		vec4 origin = texelFetch(primitives, 3 * i);
+		ivec4 exponents = ivec4(texelFetch(primitives, 3 * i + 1));
+		float coeff = texelFetch(primitives, 3 * i + 2).x;
+		vec3 r = pos - origin.xyz;
+		psi += coeff * ipow(r.x, exponents.x) * ipow(r.y, exponents.y) * ipow(r.z, exponents.z) * exp(-origin.w * dot(r, r));
 	}
 	FragColor = vec4(psi, 0.0, 0.0, 0.0);
 }
@@ -14,6 +14,8 @@ uniform sampler2D background;
 uniform vec3 camera_position;
 uniform vec3 cubemap_origin;
 uniform vec3 cubemap_size;
+// The directions of the cubemap axes, cubemap_origin and cubemap_size are given along them.
+uniform mat3 cubemap_axes;
 uniform vec3 sun_direction;
 uniform vec3 sun_color;
 uniform vec3 ambient_color;
@@ -63,6 +65,7 @@ float smoothStep(in float edge0, in float edge1, in float x)
 }
 
 float getPsi(vec3 p) {
+	p = transpose(cubemap_axes) * p;
 	p -= cubemap_origin;
 	p /= cubemap_size;
 	return texture3D(cubemap, p).x;
@@ -119,7 +122,9 @@ float toLinearDepth(float depth) {
 void main() {
 	vec3 view_vec = normalize(ray_direction);
 
-	vec2 ray_params = rayBoxDst(cubemap_origin, cubemap_origin + cubemap_size, camera_position + ray_origin, 1.0 / view_vec);
+	// The box is intersected in the frame of the cubemap, distances along the ray are the same in both frames.
+	mat3 to_cubemap = transpose(cubemap_axes);
+	vec2 ray_params = rayBoxDst(cubemap_origin, cubemap_origin + cubemap_size, to_cubemap * (camera_position + ray_origin), 1.0 / (to_cubemap * view_vec));
 
 	float depth = toLinearDepth(texture2D(depth_map, screenspace_position * 0.5 + 0.5).r) / -normalize(ray_view).z;
 
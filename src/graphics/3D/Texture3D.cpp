@@ -2,8 +2,14 @@
 #include "../GErrorHandler.h"
 #include "../Window.h"
 #include "../FrameBuffer.h"
+#include "../PixelBuffer.h"
 
 namespace fgr {
+	uint pixelFormat(uint channels) {
+		const uint formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+		return formats[channels - 1];
+	}
+
 	TextureHandle3D::TextureHandle3D(uint width, uint height, uint depth, float* _data) : width(width), height(height), depth(depth), data(4 * width * height * depth) {
 		std::copy(_data, _data + 4 * width * height * depth, data.getPtr());
 	}
@@ -22,6 +28,9 @@ namespace fgr {
 		depth = other.depth;
 
 		data = other.data;
+		host_data = other.host_data;
+		channels = other.channels;
+		half = other.half;
 
 		if (other.id) createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
 	}
@@ -32,14 +41,15 @@ namespace fgr {
 		width = _width;
 		height = _height;
 		depth = _depth;
-		data.resize(4 * width * height * depth);
+		if (host_data) data.resize(channels * width * height * depth);
+		else data.resize(0);
 
 		if (id) {
 			graphics_check_external();
 
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_3D, id);
-			glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, width, height, depth, 0, GL_RGBA, GL_FLOAT, data.getPtr());
+			glTexImage3D(GL_TEXTURE_3D, 0, internalFormat(), width, height, depth, 0, pixelFormat(channels), GL_FLOAT, pixels());
 
 			if (fbo) {
 				glBindFramebuffer(GL_FRAMEBUFFER, fbo);
@@ -62,9 +72,9 @@ namespace fgr {
 
 		TextureHandle3D::id = id;
 
-		data.resize(4 * width * height * depth);
+		data.resize(channels * width * height * depth);
 
-		glGetTexImage(GL_TEXTURE_3D, 0, GL_RGBA, GL_FLOAT, data.getPtr());
+		glGetTexImage(GL_TEXTURE_3D, 0, pixelFormat(channels), GL_FLOAT, data.getPtr());
 
 		if (fbo) {
 			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
@@ -75,6 +85,36 @@ namespace fgr {
 		graphics_check_error();
 	}
 
+	void TextureHandle3D::readToBuffer(PixelBuffer& buffer) const {
+		if (!id) return;
+
+		buffer.beginPack((size_t)channels * width * height * depth * sizeof(float));
+
+		graphics_check_external();
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_3D, id);
+		glGetTexImage(GL_TEXTURE_3D, 0, pixelFormat(channels), GL_FLOAT, nullptr);
+
+		graphics_check_error();
+
+		buffer.endPack();
+	}
+
+	void TextureHandle3D::setFromBuffer(uint buffer) {
+		if (!id) return;
+
+		graphics_check_external();
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_3D, id);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, pixelFormat(channels), GL_FLOAT, nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		graphics_check_error();
+	}
+
 	void TextureHandle3D::createBuffer(int wrap, int filter) {
 		graphics_check_external();
 
@@ -82,7 +122,7 @@ namespace fgr {
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_3D, id);
 
-		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, width, height, depth, 0, GL_RGBA, GL_FLOAT, data.getPtr());
+		glTexImage3D(GL_TEXTURE_3D, 0, internalFormat(), width, height, depth, 0, pixelFormat(channels), GL_FLOAT, pixels());
 
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, wrap);
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, wrap);
@@ -105,12 +145,12 @@ namespace fgr {
 		glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_DEPTH, &gldepth);
 
 		if (glwidth == width && glheight == height && gldepth == depth) {
-			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, GL_RGBA, GL_FLOAT, data.getPtr());
+			if (pixels()) glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, pixelFormat(channels), GL_FLOAT, pixels());
 		}
 		else {
 			int wrap = 0, filter = 0;
 
-			glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, width, height, depth, 0, GL_RGBA, GL_FLOAT, data.getPtr());
+			glTexImage3D(GL_TEXTURE_3D, 0, internalFormat(), width, height, depth, 0, pixelFormat(channels), GL_FLOAT, pixels());
 		}
 
 		if (fbo) {
@@ -151,13 +191,31 @@ namespace fgr {
 		graphics_check_error();
 	}
 
+	uint TextureHandle3D::internalFormat() const {
+		const uint half_formats[4] = { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F };
+		const uint float_formats[4] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+		return half ? half_formats[channels - 1] : float_formats[channels - 1];
+	}
+
 	void TextureHandle3D::setCuboid(int x, int y, int z, int width, int height, int depth, float* data) {
 		graphics_check_external();
 		bindToUnit(fgr::TextureUnit::misc);
-		glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, width, height, depth, GL_RGBA16F, GL_FLOAT, data);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, width, height, depth, pixelFormat(channels), GL_FLOAT, data);
 		graphics_check_error();
 	}
 
+	void TextureHandle3D::setCuboid(int x, int y, int z, int width, int height, int depth, const u16* data) {
+		graphics_check_external();
+		bindToUnit(fgr::TextureUnit::misc);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, width, height, depth, pixelFormat(channels), GL_HALF_FLOAT, data);
+		graphics_check_error();
+	}
+
+	const float* TextureHandle3D::pixels() const {
+		if (data.size() < (uint)(channels * width * height * depth)) return nullptr;
+		return data.getPtr();
+	}
+
 	void TextureHandle3D::dispose() {
 		if (!window::graphicsInitialized()) return;
 
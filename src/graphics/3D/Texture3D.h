@@ -5,6 +5,7 @@
 
 namespace fgr {
 	struct RenderTarget;
+	struct PixelBuffer;
 
 	///<summary>
 	///A struct for handling OpenGL 3D textures. One handle may be used for multiple textures throughout its lifetime.
@@ -30,6 +31,21 @@ namespace fgr {
 		///</summary>
 		flo::Array<float> data;
 
+		///<summary>
+		///If false, resizing does not allocate data and textures without data are created uninitialized. The data is then only filled by "loadFromID()".
+		///</summary>
+		bool host_data = true;
+
+		///<summary>
+		///The number of channels per texel, from 1 to 4. Applies to both the data and the OpenGL texture, so it must be set before either is created.
+		///</summary>
+		uint channels = 4;
+
+		///<summary>
+		///If true, the OpenGL texture stores 16 bit floats, otherwise 32 bit floats. The data is always 32 bit.
+		///</summary>
+		bool half = true;
+
 		TextureHandle3D() = default;
 
 		TextureHandle3D(uint width, uint height, uint depth, float* data = nullptr);
@@ -55,6 +71,18 @@ namespace fgr {
 		///<param name="id">The ID to be loaded from.</param>
 		void loadFromID(const int id);
 
+		///<summary>
+		///Start copying the OpenGL texture into a pixel buffer, as 32 bit floats with "channels" per texel. The host does not wait for the copy, the data is taken from the buffer once it has arrived.
+		///</summary>
+		///<param name="buffer">The buffer to be written to.</param>
+		void readToBuffer(PixelBuffer& buffer) const;
+
+		///<summary>
+		///Replace the contents of the OpenGL texture with 32 bit floats from an OpenGL buffer object, without passing through the host.
+		///</summary>
+		///<param name="buffer">The ID of the buffer, which holds "channels" floats per texel in the order of the texture.</param>
+		void setFromBuffer(uint buffer);
+
 		///<summary>
 		///Create a new OpenGL texture object from the present data.
 		///</summary>
@@ -78,6 +106,11 @@ namespace fgr {
 		///<param name="unit">The unit to be bound to.</param>
 		void bindToUnit(const TextureUnit unit);
 
+		///<summary>
+		///The OpenGL internal format of the texture, e.g. GL_R16F for one channel of half floats.
+		///</summary>
+		uint internalFormat() const;
+
 		///<summary>
 		///Set the image data (in the OpenGL buffer) within a given cuboid.
 		///</summary>
@@ -90,6 +123,23 @@ namespace fgr {
 		/// ///<param name="data">A pointer to read data from.</param>
 		void setCuboid(int x, int y, int z, int width, int height, int depth, float* data);
 
+		///<summary>
+		///Set the image data (in the OpenGL buffer) within a given cuboid from half floats, which halves the amount of data to be transferred.
+		///</summary>
+		///<param name="x">The x coordinate of the cuboid's corner.</param>
+		///<param name="y">The y coordinate of the cuboid's corner.</param>
+		///<param name="z">The z coordinate of the cuboid's corner.</param>
+		///<param name="width">The width of the cuboid.</param>
+		///<param name="height">The height of the cuboid.</param>
+		///<param name="depth">The depth of the cuboid.</param>
+		///<param name="data">A pointer to read data from, "channels" half floats per texel.</param>
+		void setCuboid(int x, int y, int z, int width, int height, int depth, const u16* data);
+
+		///<summary>
+		///The data to be uploaded, nullptr if the data does not cover the texture.
+		///</summary>
+		const float* pixels() const;
+
 		///<summary>
 		///Destroy present data. The OpenGL texture itself will be destroyed too.
 		///</summary>
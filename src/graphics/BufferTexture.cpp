@@ -0,0 +1,58 @@
+#include "BufferTexture.h"
+
+#include <iostream>
+
+#include "Window.h"
+#include "GErrorHandler.h"
+
+namespace fgr {
+	void BufferTexture::setData(const glm::vec4* texels, size_t count) {
+		if (!count) return;
+
+		graphics_check_external();
+
+		if (!buffer) {
+			glGenBuffers(1, &buffer);
+			glGenTextures(1, &id);
+		}
+
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		if (count > size) {
+			glBufferData(GL_TEXTURE_BUFFER, count * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+			size = count;
+		}
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, count * sizeof(glm::vec4), texels);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		bindToUnit(fgr::TextureUnit::misc);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+
+		graphics_check_error();
+	}
+
+	void BufferTexture::bindToUnit(const TextureUnit unit) {
+		graphics_check_external();
+		glActiveTexture(UNIT_ENUM_TO_GL_UNIT(unit));
+		glBindTexture(GL_TEXTURE_BUFFER, id);
+		graphics_check_error();
+	}
+
+	void BufferTexture::dispose() {
+		if (!window::graphicsInitialized()) return;
+
+		graphics_check_external();
+
+		if (!buffer) return;
+		glDeleteTextures(1, &id);
+		glDeleteBuffers(1, &buffer);
+		id = 0;
+		buffer = 0;
+		size = 0;
+
+		graphics_check_error();
+	}
+
+	BufferTexture::~BufferTexture() {
+		dispose();
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+#include "Texture.h"
+
+namespace fgr {
+	///<summary>
+	///A struct for creating and handling OpenGL buffer textures of RGBA floats, which shaders read as "samplerBuffer" with texelFetch.
+	///</summary>
+	struct BufferTexture {
+		///<summary>
+		///The IDs of the buffer object and the texture. WARNING: read-only!
+		///</summary>
+		uint buffer = 0, id = 0;
+
+		///<summary>
+		///The number of texels allocated for the buffer. WARNING: read-only!
+		///</summary>
+		size_t size = 0;
+
+		BufferTexture() = default;
+
+		///<summary>
+		///Copying and assignment not possible.
+		///</summary>
+		BufferTexture(const BufferTexture& copy) = delete;
+
+		///<summary>
+		///Copying and assignment not possible.
+		///</summary>
+		void operator=(const BufferTexture& other) = delete;
+
+		///<summary>
+		///Copy texels into the buffer, allocating it as needed.
+		///</summary>
+		///<param name="texels">A pointer to read data from.</param>
+		///<param name="count">The number of texels to copy.</param>
+		void setData(const glm::vec4* texels, size_t count);
+
+		///<summary>
+		///Bind the texture for rendering.
+		///</summary>
+		///<param name="unit">The unit to be bound to.</param>
+		void bindToUnit(const TextureUnit unit);
+
+		///<summary>
+		///Destroy the buffer and the texture.
+		///</summary>
+		void dispose();
+
+		~BufferTexture();
+	};
+}
@@ -112,7 +112,8 @@ namespace fgr {
 		glUseProgram(shader_program);
 		glDispatchCompute(work_group_count.x, work_group_count.y, work_group_count.z);
 
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		// Results may be read as images, as storage buffers, as pixel data or back on the host.
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
 
 		graphics_check_error();
 	}
@@ -0,0 +1,121 @@
+#include "PixelBuffer.h"
+
+#include <iostream>
+
+#include "Window.h"
+#include "GErrorHandler.h"
+
+namespace fgr {
+	void PixelBuffer::beginPack(size_t bytes) {
+		discard();
+
+		graphics_check_external();
+
+		if (!id) glGenBuffers(1, &id);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, id);
+		if (bytes > size) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+			size = bytes;
+		}
+
+		graphics_check_error();
+	}
+
+	void PixelBuffer::endPack() {
+		graphics_check_external();
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		// Submits the reads, so they run while the host goes on.
+		glFlush();
+
+		graphics_check_error();
+	}
+
+	void PixelBuffer::copyFromBuffer(uint buffer, size_t bytes) {
+		beginPack(bytes);
+
+		graphics_check_external();
+
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_PIXEL_PACK_BUFFER, 0, 0, bytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		graphics_check_error();
+
+		endPack();
+	}
+
+	bool PixelBuffer::pending() const {
+		return fence;
+	}
+
+	bool PixelBuffer::ready() const {
+		if (!fence) return false;
+
+		graphics_check_external();
+		const GLenum status = glClientWaitSync(fence, 0, 0);
+		graphics_check_error();
+
+		return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+	}
+
+	const void* PixelBuffer::map() {
+		if (!fence) return nullptr;
+
+		graphics_check_external();
+
+		GLenum status = GL_TIMEOUT_EXPIRED;
+		while (status == GL_TIMEOUT_EXPIRED) status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		glDeleteSync(fence);
+		fence = nullptr;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, id);
+		const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		graphics_check_error();
+
+		return data;
+	}
+
+	void PixelBuffer::unmap() {
+		if (!id) return;
+
+		graphics_check_external();
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, id);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		graphics_check_error();
+	}
+
+	void PixelBuffer::discard() {
+		if (!fence) return;
+
+		graphics_check_external();
+		glDeleteSync(fence);
+		fence = nullptr;
+		graphics_check_error();
+	}
+
+	void PixelBuffer::dispose() {
+		if (!window::graphicsInitialized()) return;
+
+		discard();
+
+		graphics_check_external();
+
+		if (!id) return;
+		glDeleteBuffers(1, &id);
+		id = 0;
+		size = 0;
+
+		graphics_check_error();
+	}
+
+	PixelBuffer::~PixelBuffer() {
+		dispose();
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <cstddef>
+
+#include "../logic/Types.h"
+
+namespace fgr {
+	///<summary>
+	///A struct for handling OpenGL pixel buffers, which receive pixel data from the GPU without stalling the host. A fence tells when the data has arrived.
+	///</summary>
+	struct PixelBuffer {
+		///<summary>
+		///The ID of the buffer object. WARNING: read-only!
+		///</summary>
+		uint id = 0;
+
+		///<summary>
+		///The number of bytes allocated for the buffer. WARNING: read-only!
+		///</summary>
+		size_t size = 0;
+
+		///<summary>
+		///The fence behind the last transfer into the buffer, nullptr if there is none. WARNING: read-only!
+		///</summary>
+		GLsync fence = nullptr;
+
+		PixelBuffer() = default;
+
+		///<summary>
+		///Copying and assignment not possible.
+		///</summary>
+		PixelBuffer(const PixelBuffer& copy) = delete;
+
+		///<summary>
+		///Copying and assignment not possible.
+		///</summary>
+		void operator=(const PixelBuffer& other) = delete;
+
+		///<summary>
+		///Bind the buffer as the target of pixel reads such as "glGetTexImage", whose data pointer is then an offset into the buffer. Drops a previous transfer.
+		///</summary>
+		///<param name="bytes">The number of bytes that are about to be read.</param>
+		void beginPack(size_t bytes);
+
+		///<summary>
+		///Unbind the buffer and place a fence behind the reads since "beginPack()".
+		///</summary>
+		void endPack();
+
+		///<summary>
+		///Copy the first bytes of another buffer object into this one on the GPU and place a fence behind the copy. Drops a previous transfer.
+		///</summary>
+		///<param name="buffer">The ID of the buffer to copy from, e.g. a shader storage buffer.</param>
+		///<param name="bytes">The number of bytes to copy.</param>
+		void copyFromBuffer(uint buffer, size_t bytes);
+
+		///<summary>
+		///Whether a transfer was started that has not been mapped or discarded since.
+		///</summary>
+		bool pending() const;
+
+		///<summary>
+		///Whether the transfer has arrived, without waiting for it.
+		///</summary>
+		bool ready() const;
+
+		///<summary>
+		///Wait for the transfer and map the buffer for reading. Returns nullptr if there is no transfer. "unmap()" must be called before the buffer is used again.
+		///</summary>
+		const void* map();
+
+		///<summary>
+		///Release the mapping of "map()".
+		///</summary>
+		void unmap();
+
+		///<summary>
+		///Forget about a pending transfer, its data is not needed anymore.
+		///</summary>
+		void discard();
+
+		///<summary>
+		///Destroy the buffer object.
+		///</summary>
+		void dispose();
+
+		~PixelBuffer();
+	};
+}
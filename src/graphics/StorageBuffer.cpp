@@ -0,0 +1,70 @@
+#include "StorageBuffer.h"
+
+#include <iostream>
+
+#include "Window.h"
+#include "GErrorHandler.h"
+
+namespace fgr {
+	void StorageBuffer::reserve(size_t bytes) {
+		graphics_check_external();
+
+		if (!id) glGenBuffers(1, &id);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, id);
+		if (bytes > size) {
+			glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+			size = bytes;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		graphics_check_error();
+	}
+
+	void StorageBuffer::setData(const void* data, size_t bytes) {
+		if (!bytes) return;
+		reserve(bytes);
+
+		graphics_check_external();
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, id);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		graphics_check_error();
+	}
+
+	void StorageBuffer::getData(void* data, size_t bytes, size_t offset) const {
+		if (!id || !bytes) return;
+
+		graphics_check_external();
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, id);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, bytes, data);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		graphics_check_error();
+	}
+
+	void StorageBuffer::bind(uint binding) const {
+		graphics_check_external();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, id);
+		graphics_check_error();
+	}
+
+	void StorageBuffer::dispose() {
+		if (!window::graphicsInitialized()) return;
+
+		graphics_check_external();
+
+		if (!id) return;
+		glDeleteBuffers(1, &id);
+		id = 0;
+		size = 0;
+
+		graphics_check_error();
+	}
+
+	StorageBuffer::~StorageBuffer() {
+		dispose();
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <cstddef>
+
+#include "../logic/Types.h"
+
+namespace fgr {
+	///<summary>
+	///A struct for creating and handling OpenGL shader storage buffers, which compute shaders can read and write as arrays.
+	///</summary>
+	struct StorageBuffer {
+		///<summary>
+		///The ID of the buffer object. WARNING: read-only!
+		///</summary>
+		uint id = 0;
+
+		///<summary>
+		///The number of bytes allocated for the buffer. WARNING: read-only!
+		///</summary>
+		size_t size = 0;
+
+		StorageBuffer() = default;
+
+		///<summary>
+		///Copying and assignment not possible.
+		///</summary>
+		StorageBuffer(const StorageBuffer& copy) = delete;
+
+		///<summary>
+		///Copying and assignment not possible.
+		///</summary>
+		void operator=(const StorageBuffer& other) = delete;
+
+		///<summary>
+		///Allocate the buffer if it is smaller than the given size. The contents are undefined afterwards.
+		///</summary>
+		///<param name="bytes">The number of bytes required.</param>
+		void reserve(size_t bytes);
+
+		///<summary>
+		///Copy data into the buffer, allocating it as needed.
+		///</summary>
+		///<param name="data">A pointer to read data from.</param>
+		///<param name="bytes">The number of bytes to copy.</param>
+		void setData(const void* data, size_t bytes);
+
+		///<summary>
+		///Copy part of the buffer back to the host.
+		///</summary>
+		///<param name="data">A pointer to write data to.</param>
+		///<param name="bytes">The number of bytes to copy.</param>
+		///<param name="offset">The number of bytes to skip at the beginning of the buffer.</param>
+		void getData(void* data, size_t bytes, size_t offset = 0) const;
+
+		///<summary>
+		///Bind the buffer to the binding point of a storage block, as in "layout(std430, binding = 0)".
+		///</summary>
+		///<param name="binding">The binding point.</param>
+		void bind(uint binding) const;
+
+		///<summary>
+		///Destroy the buffer object.
+		///</summary>
+		void dispose();
+
+		~StorageBuffer();
+	};
+}
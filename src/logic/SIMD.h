@@ -0,0 +1,159 @@
+#pragma once
+#include <cstring>
+#include <cmath>
+#include <cinttypes>
+
+#include "Types.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FLO_SSE_CSR 1
+#endif
+
+// Kernels are compiled for several instruction sets and picked at runtime, so that one binary runs everywhere and uses AVX2 or AVX-512 where available.
+// Target attributes only exist on GCC and Clang, other compilers stay with whatever instruction set the build enables.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FLO_SIMD_DISPATCH 1
+#define FLO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define FLO_TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx2,fma")))
+#define FLO_INLINE inline __attribute__((always_inline))
+#else
+#define FLO_SIMD_DISPATCH 0
+#define FLO_TARGET_AVX2
+#define FLO_TARGET_AVX512
+#define FLO_INLINE inline
+#endif
+
+namespace flo {
+#if defined(__AVX512F__)
+	constexpr uint simd_register_bytes = 64;
+#elif defined(__AVX__)
+	constexpr uint simd_register_bytes = 32;
+#else
+	constexpr uint simd_register_bytes = 16;
+#endif
+
+	///<summary>
+	/// Width of the widest SIMD registers in bytes that kernels can use on this CPU: 64 with AVX-512, 32 with AVX2 and FMA, 16 otherwise.
+	/// Never below what the build enables anyway.
+	///</summary>
+	inline uint simdRegisterBytes() {
+#if FLO_SIMD_DISPATCH
+		static const uint bytes = []() {
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) return 64u;
+			if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return 32u;
+			return 16u;
+		}();
+		return bytes > simd_register_bytes ? bytes : simd_register_bytes;
+#else
+		return simd_register_bytes;
+#endif
+	}
+
+	///<summary>
+	/// The number of lanes processed together by the vectorized kernels for a given element type and register width.
+	/// This amounts to 4, 8 or 16 floats (SSE, AVX2, AVX-512) and 4 or 8 doubles. Lane loops are plain fixed-size loops,
+	/// the compiler maps them onto the instruction set of the function they are inlined into (see FLO_TARGET_AVX2 and FLO_TARGET_AVX512).
+	///</summary>
+	template<typename T, uint Bytes = simd_register_bytes>
+	constexpr int lane_count = Bytes / sizeof(T) < 4 ? 4 : Bytes / sizeof(T);
+
+	template<typename T>
+	struct ExpConstants;
+
+	template<>
+	struct ExpConstants<double> {
+		typedef std::uint64_t Int;
+		static constexpr double min_arg = -708.0, max_arg = 709.0;
+		static constexpr double shifter = 6755399441055744.0; // 1.5 * 2^52
+		static constexpr double ln2_hi = 6.93147180369123816490e-01, ln2_lo = 1.90821492927058770002e-10;
+		static constexpr Int exponent_bias = 1023, mantissa_bits = 52;
+		static constexpr int degree = 12;
+	};
+
+	template<>
+	struct ExpConstants<float> {
+		typedef std::uint32_t Int;
+		static constexpr float min_arg = -87.0f, max_arg = 88.0f;
+		static constexpr float shifter = 12582912.0f; // 1.5 * 2^23
+		static constexpr float ln2_hi = 0.693359375f, ln2_lo = -2.12194440e-4f;
+		static constexpr Int exponent_bias = 127, mantissa_bits = 23;
+		static constexpr int degree = 7;
+	};
+
+	///<summary>
+	/// Lane-wise exponential of N values, written so that it vectorizes without intrinsics.
+	/// The argument is split as x = n*ln(2) + r with |r| <= ln(2)/2 (Cody-Waite), exp(r) is a Taylor polynomial of degree 12 (double) or 7 (float)
+	/// and 2^n is assembled from the exponent bits.
+	/// Error bound: relative error below 4e-16 (double) and 3e-7 (float), i.e. within 2-3 ulp, for x in [min_arg, max_arg].
+	/// Arguments below min_arg return exactly 0, arguments above max_arg are clamped. Kernels for registers narrower than AVX use std::exp instead.
+	/// Always inlined, so that it is compiled for the instruction set of the kernel that calls it.
+	///</summary>
+	///<param name="x">N input values.</param>
+	///<param name="result">N output values, may alias x.</param>
+	template<typename T, int N, uint Bytes = simd_register_bytes>
+	FLO_INLINE void exp(const T* x, T* result) {
+		typedef ExpConstants<T> C;
+		typedef typename C::Int Int;
+
+		if constexpr (Bytes < 32) {
+			// Without AVX, the polynomial is not vectorized reliably and libm is faster.
+			for (int i = 0; i < N; ++i) result[i] = std::exp(x[i]);
+			return;
+		}
+
+		alignas(64) T shifted[N], r[N], p[N];
+		alignas(64) Int bits[N];
+
+		for (int i = 0; i < N; ++i) {
+			T v = x[i];
+			v = v < C::min_arg ? C::min_arg : v;
+			v = v > C::max_arg ? C::max_arg : v;
+			shifted[i] = v * (T)1.4426950408889634074 + C::shifter;
+			T n = shifted[i] - C::shifter;
+			r[i] = v - n * C::ln2_hi - n * C::ln2_lo;
+		}
+
+		T coefficients[C::degree + 1];
+		coefficients[0] = (T)1.0;
+		for (int k = 1; k <= C::degree; ++k) coefficients[k] = coefficients[k - 1] / (T)k;
+
+		for (int i = 0; i < N; ++i) p[i] = coefficients[C::degree];
+		for (int k = C::degree - 1; k >= 0; --k) {
+			for (int i = 0; i < N; ++i) p[i] = coefficients[k] + p[i] * r[i];
+		}
+
+		// The rounded n sits in the low mantissa bits of the shifted value, moving it into the exponent field avoids a float to int conversion.
+		std::memcpy(bits, shifted, sizeof(bits));
+		for (int i = 0; i < N; ++i) {
+			bits[i] = (bits[i] + C::exponent_bias) << C::mantissa_bits;
+		}
+		alignas(64) T scale[N];
+		std::memcpy(scale, bits, sizeof(scale));
+
+		for (int i = 0; i < N; ++i) {
+			T value = p[i] * scale[i];
+			result[i] = x[i] < C::min_arg ? (T)0.0 : value;
+		}
+	}
+
+	///<summary>
+	/// Treats denormal floats as zero on the current thread for as long as it exists. On x86, arithmetic with denormals is extremely slow,
+	/// and the tails of basis functions produce plenty of them.
+	///</summary>
+	struct FlushDenormals {
+#if FLO_SSE_CSR
+		uint previous;
+
+		FlushDenormals() : previous(_mm_getcsr()) {
+			// Flush-to-zero and denormals-are-zero bits.
+			_mm_setcsr(previous | 0x8040);
+		}
+
+		~FlushDenormals() {
+			_mm_setcsr(previous);
+		}
+#endif
+	};
+}
@@ -0,0 +1,135 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace flo {
+	// Index of the queue owned by the current thread, -1 outside of the pool.
+	thread_local int worker_index = -1;
+
+	ThreadPool::~ThreadPool() {
+		stop();
+	}
+
+	ThreadPool& ThreadPool::global() {
+		static ThreadPool& pool = []() -> ThreadPool& {
+			static ThreadPool instance;
+			instance.resize(0);
+			return instance;
+		}();
+		return pool;
+	}
+
+	void ThreadPool::resize(uint thread_count) {
+		if (!thread_count) thread_count = std::thread::hardware_concurrency();
+		if (!thread_count) thread_count = 1;
+		if (queues.size() && thread_count == threadCount()) return;
+
+		stop();
+
+		queues.resize(thread_count);
+		for (uint i = 0; i < thread_count; ++i) queues[i] = std::make_unique<Queue>();
+
+		stopping = false;
+		for (uint i = 0; i < thread_count - 1; ++i) workers.emplace_back(&ThreadPool::work, this, i);
+	}
+
+	uint ThreadPool::threadCount() const {
+		return workers.size() + 1;
+	}
+
+	void ThreadPool::stop() {
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) worker.join();
+		workers.clear();
+		queues.clear();
+	}
+
+	void ThreadPool::run(uint count, uint grain, const std::function<void(uint, uint)>& body) {
+		if (!grain) grain = 1;
+		const uint task_count = (count + grain - 1) / grain;
+
+		if (workers.empty() || task_count == 1) {
+			body(0, count);
+			return;
+		}
+
+		Job job;
+		job.body = &body;
+		job.remaining = task_count;
+
+		// Counted before they are pushed, so that the count never drops below zero while tasks are being taken.
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			queued += task_count;
+		}
+		// Consecutive tasks go to different queues, neighbouring parts of a grid tend to cost about the same.
+		for (uint i = 0; i < task_count; ++i) {
+			Queue& queue = *queues[i % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back(Task{ &job, i * grain, std::min((i + 1) * grain, count) });
+		}
+		wake.notify_all();
+
+		const uint own = worker_index < 0 ? (uint)queues.size() - 1 : (uint)worker_index;
+		Task task;
+		while (job.remaining) {
+			if (take(own, task)) {
+				execute(task);
+				continue;
+			}
+			// Everything is queued or running elsewhere, wait for the last task of this loop.
+			std::unique_lock<std::mutex> lock(job.mutex);
+			job.done.wait(lock, [&job]() { return job.remaining == 0; });
+		}
+
+		// The thread that finished the last task may still hold the lock, job must outlive it.
+		std::lock_guard<std::mutex> lock(job.mutex);
+	}
+
+	bool ThreadPool::take(uint own, Task& task) {
+		for (uint i = 0; i < queues.size(); ++i) {
+			Queue& queue = *queues[(own + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty()) continue;
+
+			// The own queue is worked from the front, other queues are stolen from at the back.
+			if (!i) {
+				task = queue.tasks.front();
+				queue.tasks.pop_front();
+			}
+			else {
+				task = queue.tasks.back();
+				queue.tasks.pop_back();
+			}
+			--queued;
+			return true;
+		}
+		return false;
+	}
+
+	void ThreadPool::execute(const Task& task) {
+		Job& job = *task.job;
+		(*job.body)(task.begin, task.end);
+		std::lock_guard<std::mutex> lock(job.mutex);
+		if (--job.remaining == 0) job.done.notify_all();
+	}
+
+	void ThreadPool::work(uint index) {
+		worker_index = index;
+		Task task;
+		while (true) {
+			if (take(index, task)) {
+				execute(task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			wake.wait(lock, [this]() { return stopping || queued > 0; });
+			if (stopping) return;
+		}
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "Types.h"
+
+namespace flo {
+	///<summary>
+	/// A process-wide pool of worker threads for data-parallel loops. Every worker owns a queue of tasks and steals from the back
+	/// of the other queues once its own runs dry, so that uneven tasks balance out. The thread that starts a loop works along.
+	///</summary>
+	class ThreadPool {
+	public:
+		ThreadPool() = default;
+
+		ThreadPool(const ThreadPool& other) = delete;
+
+		~ThreadPool();
+
+		///<summary>
+		/// The pool shared by the whole process. It starts out with one thread per hardware thread.
+		///</summary>
+		static ThreadPool& global();
+
+		///<summary>
+		/// Set the number of threads that work on a loop, including the calling thread. Must not be called while loops are running.
+		///</summary>
+		///<param name="thread_count">The new number of threads, 0 uses one thread per hardware thread.</param>
+		void resize(uint thread_count);
+
+		///<summary>
+		/// The number of threads that work on a loop, including the calling thread.
+		///</summary>
+		uint threadCount() const;
+
+		///<summary>
+		/// Call f(i) for every i in [0, count) and return once all calls have finished. Calls happen concurrently and in no particular order.
+		/// May be called from within a loop, the calling thread then helps with whatever work is queued until its own loop is done.
+		///</summary>
+		///<param name="count">The number of indices.</param>
+		///<param name="f">Callable taking a uint index.</param>
+		///<param name="grain">The number of consecutive indices per task.</param>
+		template<typename F>
+		void parallelFor(uint count, const F& f, uint grain = 1) {
+			if (!count) return;
+			const std::function<void(uint, uint)> body = [&f](uint begin, uint end) {
+				for (uint i = begin; i < end; ++i) f(i);
+			};
+			run(count, grain, body);
+		}
+
+	private:
+		struct Job {
+			const std::function<void(uint, uint)>* body = nullptr;
+			std::atomic<uint> remaining = 0;
+			std::mutex mutex;
+			std::condition_variable done;
+		};
+
+		struct Task {
+			Job* job = nullptr;
+			uint begin = 0, end = 0;
+		};
+
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		// One queue per worker, the last one is shared by the threads outside of the pool.
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> workers;
+		std::atomic<uint> queued = 0;
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+		bool stopping = false;
+
+		void run(uint count, uint grain, const std::function<void(uint, uint)>& body);
+
+		bool take(uint queue, Task& task);
+
+		void execute(const Task& task);
+
+		void work(uint index);
+
+		void stop();
+	};
+}
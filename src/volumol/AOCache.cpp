@@ -0,0 +1,137 @@
+#include "AOCache.h"
+
+#include "Settings.h"
+
+#include <cmath>
+
+namespace mol {
+	// Number of orbitals that are evaluated from one pass over the cached values of a tile.
+	constexpr uint orbital_block = 8;
+
+	template<typename T>
+	void cacheTile(const GridEvaluator& evaluator, uint tile, std::vector<uint>& functions, std::vector<float>& values) {
+		const glm::ivec3 min = evaluator.grid.tileMin(tile);
+		const glm::ivec3 max = evaluator.grid.tileMax(tile);
+
+		std::vector<uint> list;
+		std::vector<T> tile_values;
+		evaluator.listFunctions(min, max, list);
+		evaluator.evaluateFunctions(min, max, list, functions, tile_values);
+		values.assign(tile_values.begin(), tile_values.end());
+	}
+
+	void combineFunctions(const std::vector<uint>& functions, const float* values, uint planes, const std::vector<const std::vector<double>*>& coefficients,
+		uint first, uint count, float* psi) {
+		const uint length = planes * tile_voxels;
+
+		for (uint i = 0; i < count * length; ++i) psi[i] = 0.f;
+
+		for (uint k = 0; k < functions.size(); ++k) {
+			const float* v = values + k * length;
+			for (uint b = 0; b < count; ++b) {
+				const std::vector<double>& c = *coefficients[first + b];
+				if (functions[k] >= c.size() || c[functions[k]] == 0.0) continue;
+
+				const float w = (float)c[functions[k]];
+				float* out = psi + b * length;
+				for (uint i = 0; i < length; ++i) out[i] += w * v[i];
+			}
+		}
+	}
+
+	// Writes the orbitals of one tile into the maps, orbital_block at a time.
+	void writeTileOrbitals(uint tile, const std::vector<uint>& functions, const float* values, uint planes,
+		const std::vector<const std::vector<double>*>& coefficients, const std::vector<CubeMap*>& maps) {
+		const uint length = planes * tile_voxels;
+		std::vector<float> psi(orbital_block * length);
+		for (uint first = 0; first < coefficients.size(); first += orbital_block) {
+			const uint count = glm::min(orbital_block, (uint)coefficients.size() - first);
+			combineFunctions(functions, values, planes, coefficients, first, count, psi.data());
+
+			for (uint b = 0; b < count; ++b) {
+				const float* orbital = psi.data() + b * length;
+				maps[first + b]->bricks.writeTile(tile, orbital, planes > 1 ? orbital + tile_voxels : nullptr);
+			}
+		}
+	}
+
+	bool AOCache::matches(const CubeMap& map, const std::vector<ContractedBasis>* basis) const {
+		return this->basis && this->basis == basis && grid.dimensions == glm::ivec3(map.texture.width, map.texture.height, map.texture.depth) &&
+			grid.origin == map.origin && size == map.size && gradients == map.bricks.hasGradients() && tolerance == settings.cubemap_tolerance;
+	}
+
+	void AOCache::build(const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells) {
+		clear();
+
+		// The cache serves any orbital, so functions are only screened by their own magnitude.
+		GridEvaluator evaluator(map, basis, shells, std::vector<double>(basis.size(), 1.0), settings.cubemap_separable, true, settings.cubemap_tolerance);
+		grid = evaluator.grid;
+		size = map.size;
+		this->basis = &basis;
+		gradients = evaluator.gradients;
+		tolerance = settings.cubemap_tolerance;
+
+		tile_functions.resize(grid.size());
+		tile_values.resize(grid.size());
+		forEachTile(grid.size(), [&](uint tile) {
+			if (settings.cubemap_single_precision) cacheTile<float>(evaluator, tile, tile_functions[tile], tile_values[tile]);
+			else cacheTile<double>(evaluator, tile, tile_functions[tile], tile_values[tile]);
+		});
+	}
+
+	void AOCache::clear() {
+		grid = TileGrid();
+		size = glm::dvec3(0.0);
+		basis = nullptr;
+		gradients = false;
+		tolerance = 0.f;
+		tile_functions.clear();
+		tile_values.clear();
+	}
+
+	size_t AOCache::memory() const {
+		size_t result = 0;
+		for (uint tile = 0; tile < tile_values.size(); ++tile) {
+			result += tile_values[tile].size() * sizeof(float) + tile_functions[tile].size() * sizeof(uint);
+		}
+		return result;
+	}
+
+	void AOCache::writeOrbitals(const std::vector<const std::vector<double>*>& coefficients, const std::vector<CubeMap*>& maps) const {
+		forEachTile(grid.size(), [&](uint tile) {
+			writeTileOrbitals(tile, tile_functions[tile], tile_values[tile].data(), gradients ? 4 : 1, coefficients, maps);
+		});
+	}
+
+	void writeOrbitals(const std::vector<const std::vector<double>*>& coefficients, const std::vector<CubeMap*>& maps,
+		const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells) {
+		// Functions are screened by their largest coefficient in any of the orbitals.
+		std::vector<double> weights(basis.size(), 0.0);
+		for (const std::vector<double>* c : coefficients) {
+			for (uint i = 0; i < weights.size() && i < c->size(); ++i) weights[i] = glm::max(weights[i], std::abs((*c)[i]));
+		}
+		GridEvaluator evaluator(*maps[0], basis, shells, std::vector<double>(basis.size(), 1.0), settings.cubemap_separable, true, settings.cubemap_tolerance, &weights);
+		const uint planes = evaluator.gradients ? 4 : 1;
+
+		forEachTile(evaluator.grid.size(), [&](uint tile) {
+			std::vector<uint> functions;
+			std::vector<float> values;
+			if (settings.cubemap_single_precision) cacheTile<float>(evaluator, tile, functions, values);
+			else cacheTile<double>(evaluator, tile, functions, values);
+			writeTileOrbitals(tile, functions, values.data(), planes, coefficients, maps);
+		});
+	}
+
+	void AOCache::writeDensity(const DensityMatrix& density, CubeMap& map, bool add) const {
+		forEachTile(grid.size(), [&](uint tile) {
+			storeTileDensity(density, tile, tile_functions[tile], tile_values[tile].data(), tolerance, gradients, map.bricks, add);
+		});
+	}
+
+	void AOCache::writeSpinDensity(const DensityMatrix& total, const DensityMatrix& spin, BrickMap& total_bricks, BrickMap& spin_bricks, bool add) const {
+		forEachTile(grid.size(), [&](uint tile) {
+			storeTileDensity(total, tile, tile_functions[tile], tile_values[tile].data(), tolerance, gradients, total_bricks, add);
+			storeTileDensity(spin, tile, tile_functions[tile], tile_values[tile].data(), tolerance, gradients, spin_bricks, add);
+		});
+	}
+}
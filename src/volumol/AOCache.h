@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+
+#include "Density.h"
+
+namespace mol {
+	// Values of the basis functions on the cubemap grid, stored sparsely: Each tile only keeps the functions that overlap it.
+	// Orbitals are then produced as a matrix product of these values with the LCAO coefficients, blocks of orbitals share every read of the cache.
+	struct AOCache {
+		TileGrid grid;
+		glm::dvec3 size = glm::dvec3(0.0);
+		const std::vector<ContractedBasis>* basis = nullptr;
+		// If set, each function keeps its x, y and z derivatives after its values.
+		bool gradients = false;
+		// Screening tolerance the functions were cached with, for unit coefficients.
+		float tolerance = 0.f;
+		std::vector<std::vector<uint>> tile_functions;
+		std::vector<std::vector<float>> tile_values;
+
+		bool matches(const CubeMap& map, const std::vector<ContractedBasis>* basis) const;
+
+		void build(const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells);
+
+		void clear();
+
+		size_t memory() const;
+
+		// Writes one orbital per map, all maps must have the dimensions of the cache.
+		void writeOrbitals(const std::vector<const std::vector<double>*>& coefficients, const std::vector<CubeMap*>& maps) const;
+
+		// Writes the electron density, the map must have the dimensions of the cache. If add is set, it is added to the values in the map.
+		void writeDensity(const DensityMatrix& density, CubeMap& map, bool add = false) const;
+
+		// Writes the total and the spin density into bricks with the dimensions of the cache, see writeSpinDensity().
+		void writeSpinDensity(const DensityMatrix& total, const DensityMatrix& spin, BrickMap& total_bricks, BrickMap& spin_bricks, bool add = false) const;
+	};
+
+	// Combines the basis function values of a tile, planes of tile_voxels values per function, into a block of count orbitals.
+	// psi receives planes * tile_voxels values per orbital.
+	void combineFunctions(const std::vector<uint>& functions, const float* values, uint planes, const std::vector<const std::vector<double>*>& coefficients,
+		uint first, uint count, float* psi);
+
+	// Writes one orbital per map like AOCache::writeOrbitals, but only keeps the basis functions of the tile at hand:
+	// Each tile evaluates the functions that overlap it once, all orbitals are then combined from them. All maps must share one grid.
+	void writeOrbitals(const std::vector<const std::vector<double>*>& coefficients, const std::vector<CubeMap*>& maps,
+		const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells);
+}
@@ -0,0 +1,209 @@
+#include "BrickMap.h"
+
+#include "../logic/ThreadPool.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace mol {
+	void BrickMap::resize(const glm::ivec3& _dimensions) {
+		dimensions = _dimensions;
+		brick_count = (dimensions + glm::ivec3(tile_width, tile_size, tile_size) - 1) / glm::ivec3(tile_width, tile_size, tile_size);
+		bricks.clear();
+		bricks.resize(brick_count.x * brick_count.y * brick_count.z);
+	}
+
+	void BrickMap::clear() {
+		for (std::unique_ptr<float[]>& brick : bricks) brick.reset();
+	}
+
+	void BrickMap::setChannels(int _channels) {
+		if (channels == _channels) return;
+		channels = _channels;
+		clear();
+	}
+
+	uint BrickMap::allocatedCount() const {
+		uint result = 0;
+		for (const std::unique_ptr<float[]>& brick : bricks) result += brick ? 1 : 0;
+		return result;
+	}
+
+	size_t BrickMap::memory() const {
+		return (size_t)allocatedCount() * channels * tile_voxels * sizeof(float) + bricks.size() * sizeof(bricks[0]);
+	}
+
+	glm::ivec3 BrickMap::brickMin(uint brick) const {
+		return glm::ivec3(tile_width, tile_size, tile_size) * glm::ivec3(brick % brick_count.x, brick / brick_count.x % brick_count.y, brick / (brick_count.x * brick_count.y));
+	}
+
+	glm::ivec3 BrickMap::brickMax(uint brick) const {
+		return glm::min(brickMin(brick) + glm::ivec3(tile_width, tile_size, tile_size), dimensions);
+	}
+
+	float* BrickMap::allocate(uint brick) {
+		if (!bricks[brick]) bricks[brick] = std::make_unique<float[]>(channels * tile_voxels);
+		return bricks[brick].get();
+	}
+
+	void BrickMap::release(uint brick) {
+		bricks[brick].reset();
+	}
+
+	void BrickMap::set(const glm::ivec3& voxel, float value) {
+		const uint brick = brickIndex(voxel);
+		if (!bricks[brick] && std::abs(value) < brick_cutoff) return;
+		allocate(brick)[channels * (voxel.x % tile_width + tile_width * (voxel.y % tile_size + tile_size * (voxel.z % tile_size)))] = value;
+	}
+
+	float BrickMap::tileMagnitude(uint brick, const float* values) const {
+		const glm::ivec3 extent = brickMax(brick) - brickMin(brick);
+
+		float magnitude = 0.f;
+		for (int z = 0; z < extent.z; ++z) {
+			for (int y = 0; y < extent.y; ++y) {
+				const float* row = values + tile_width * (y + tile_size * z);
+				for (int x = 0; x < extent.x; ++x) magnitude = std::max(magnitude, std::abs(row[x]));
+			}
+		}
+		return magnitude;
+	}
+
+	void BrickMap::writeTile(uint brick, const float* values, const float* gradient) {
+		if (tileMagnitude(brick, values) < brick_cutoff) {
+			release(brick);
+			return;
+		}
+
+		float* data = allocate(brick);
+		if (!hasGradients()) {
+			std::copy(values, values + tile_voxels, data);
+			return;
+		}
+		for (int i = 0; i < tile_voxels; ++i) {
+			data[4 * i] = values[i];
+			data[4 * i + 1] = gradient ? gradient[i] : 0.f;
+			data[4 * i + 2] = gradient ? gradient[i + tile_voxels] : 0.f;
+			data[4 * i + 3] = gradient ? gradient[i + 2 * tile_voxels] : 0.f;
+		}
+	}
+
+	void BrickMap::addTile(uint brick, const float* values, const float* gradient) {
+		if (tileMagnitude(brick, values) < brick_cutoff) return;
+
+		float* data = allocate(brick);
+		if (!hasGradients()) {
+			for (int i = 0; i < tile_voxels; ++i) data[i] += values[i];
+			return;
+		}
+		for (int i = 0; i < tile_voxels; ++i) {
+			data[4 * i] += values[i];
+			if (!gradient) continue;
+			data[4 * i + 1] += gradient[i];
+			data[4 * i + 2] += gradient[i + tile_voxels];
+			data[4 * i + 3] += gradient[i + 2 * tile_voxels];
+		}
+	}
+
+	void BrickMap::compact() {
+		flo::ThreadPool::global().parallelFor(bricks.size(), [this](uint brick) {
+			const float* data = bricks[brick].get();
+			if (!data) return;
+			float magnitude = 0.f;
+			for (int i = 0; i < channels * tile_voxels; ++i) magnitude = std::max(magnitude, std::abs(data[i]));
+			if (magnitude < brick_cutoff) release(brick);
+		});
+	}
+
+	void BrickMap::fromDense(const float* dense, int data_channels) {
+		fromDenseLayers(dense, data_channels, 0, brick_count.z);
+	}
+
+	void BrickMap::fromDenseLayers(const float* dense, int data_channels, int first_layer, int layer_count) {
+		const int copied = std::min(channels, data_channels);
+		const uint layer_bricks = brick_count.x * brick_count.y;
+		const int z_offset = first_layer * tile_size;
+		flo::ThreadPool::global().parallelFor(layer_bricks * layer_count, [this, dense, data_channels, copied, layer_bricks, first_layer, z_offset](uint i) {
+			const uint brick = i + layer_bricks * first_layer;
+			const glm::ivec3 min = brickMin(brick);
+			const glm::ivec3 extent = brickMax(brick) - min;
+
+			float magnitude = 0.f;
+			for (int z = 0; z < extent.z; ++z) {
+				for (int y = 0; y < extent.y; ++y) {
+					const float* row = dense + data_channels * (min.x + dimensions.x * (min.y + y + dimensions.y * (min.z - z_offset + z)));
+					for (int x = 0; x < data_channels * extent.x; ++x) magnitude = std::max(magnitude, std::abs(row[x]));
+				}
+			}
+			if (magnitude < brick_cutoff) {
+				release(brick);
+				return;
+			}
+
+			float* data = allocate(brick);
+			for (int z = 0; z < extent.z; ++z) {
+				for (int y = 0; y < extent.y; ++y) {
+					const float* row = dense + data_channels * (min.x + dimensions.x * (min.y + y + dimensions.y * (min.z - z_offset + z)));
+					float* out = data + channels * tile_width * (y + tile_size * z);
+					for (int x = 0; x < extent.x; ++x) {
+						for (int c = 0; c < copied; ++c) out[channels * x + c] = row[data_channels * x + c];
+					}
+				}
+			}
+		});
+	}
+
+	float toTexel(float value, float) {
+		return value;
+	}
+
+	u16 toTexel(float value, u16) {
+		return glm::packHalf1x16(value);
+	}
+
+	// One layer of bricks at a time is expanded into dense rows, which bounds the extra memory to tile_size slices of the texture.
+	// Conversion to half floats happens here as well, spread over the threads like the expansion.
+	template<typename T>
+	void uploadLayers(const BrickMap& map, fgr::TextureHandle3D& texture) {
+		const glm::ivec3& dimensions = map.dimensions;
+		const int texture_channels = texture.channels;
+		const int copied = std::min(map.channels, texture_channels);
+
+		std::vector<T> slab(texture_channels * dimensions.x * dimensions.y * tile_size);
+		for (int layer = 0; layer < map.brick_count.z; ++layer) {
+			const int z_min = layer * tile_size;
+			const int depth = std::min(tile_size, dimensions.z - z_min);
+
+			flo::ThreadPool::global().parallelFor(map.brick_count.x * map.brick_count.y, [&](uint i) {
+				const uint brick = i + map.brick_count.x * map.brick_count.y * layer;
+				const glm::ivec3 min = map.brickMin(brick);
+				const glm::ivec3 extent = map.brickMax(brick) - min;
+				const float* data = map.bricks[brick].get();
+
+				for (int z = 0; z < extent.z; ++z) {
+					for (int y = 0; y < extent.y; ++y) {
+						T* row = slab.data() + texture_channels * (min.x + dimensions.x * (min.y + y + dimensions.y * z));
+						std::fill(row, row + texture_channels * extent.x, toTexel(0.f, T()));
+						if (!data) continue;
+
+						const float* in = data + map.channels * tile_width * (y + tile_size * z);
+						for (int x = 0; x < extent.x; ++x) {
+							for (int c = 0; c < copied; ++c) row[texture_channels * x + c] = toTexel(in[map.channels * x + c], T());
+						}
+					}
+				}
+			});
+
+			texture.setCuboid(0, 0, z_min, dimensions.x, dimensions.y, depth, slab.data());
+		}
+	}
+
+	void BrickMap::upload(fgr::TextureHandle3D& texture) const {
+		if (!texture.id) texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
+
+		if (texture.half) uploadLayers<u16>(*this, texture);
+		else uploadLayers<float>(*this, texture);
+	}
+}
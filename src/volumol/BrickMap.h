@@ -0,0 +1,97 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+
+#include "../graphics/3D/Texture3D.h"
+
+namespace mol {
+	// Edge length of the blocks of voxels that are evaluated and stored as one unit.
+	// Blocks are twice as wide along x, where rows are processed in SIMD lanes; 16x8x8 voxels of psi fit comfortably into L1 cache.
+	constexpr int tile_size = 8;
+	constexpr int tile_width = 2 * tile_size;
+	constexpr int tile_voxels = tile_width * tile_size * tile_size;
+
+	// Bricks whose values all stay below this magnitude are not stored.
+	constexpr float brick_cutoff = 1e-8f;
+
+	// Voxel data of a cubemap on the CPU, in bricks of tile_width x tile_size x tile_size voxels.
+	// Bricks are numbered like the tiles of a TileGrid. Only bricks with non-negligible values are allocated, all others read as zero.
+	struct BrickMap {
+		glm::ivec3 dimensions = glm::ivec3(0);
+		glm::ivec3 brick_count = glm::ivec3(0);
+		// Floats per voxel: 1 for the values alone, 4 if the x, y and z components of the gradient follow each value.
+		int channels = 1;
+		std::vector<std::unique_ptr<float[]>> bricks;
+
+		// Releases all bricks.
+		void resize(const glm::ivec3& dimensions);
+
+		void clear();
+
+		// Releases all bricks if the number of channels changes.
+		void setChannels(int channels);
+
+		bool hasGradients() const {
+			return channels == 4;
+		}
+
+		uint allocatedCount() const;
+
+		size_t memory() const;
+
+		glm::ivec3 brickMin(uint brick) const;
+
+		glm::ivec3 brickMax(uint brick) const;
+
+		uint brickIndex(const glm::ivec3& voxel) const {
+			return voxel.x / tile_width + brick_count.x * (voxel.y / tile_size + brick_count.y * (voxel.z / tile_size));
+		}
+
+		float value(const glm::ivec3& voxel) const {
+			const float* brick = bricks[brickIndex(voxel)].get();
+			if (!brick) return 0.f;
+			return brick[channels * (voxel.x % tile_width + tile_width * (voxel.y % tile_size + tile_size * (voxel.z % tile_size)))];
+		}
+
+		// Zero unless the map holds gradients.
+		glm::vec3 gradient(const glm::ivec3& voxel) const {
+			const float* brick = bricks[brickIndex(voxel)].get();
+			if (!brick || !hasGradients()) return glm::vec3(0.f);
+			const float* v = brick + 4 * (voxel.x % tile_width + tile_width * (voxel.y % tile_size + tile_size * (voxel.z % tile_size)));
+			return glm::vec3(v[1], v[2], v[3]);
+		}
+
+		// Returns the brick, allocating it filled with zeros if necessary.
+		float* allocate(uint brick);
+
+		void release(uint brick);
+
+		void set(const glm::ivec3& voxel, float value);
+
+		// Stores one tile of values (tile_voxels, rows of tile_width) in the first channel of a brick.
+		// With gradients, the other channels receive the x, y and z planes of gradient, tile_voxels values each, or are cleared if there is none.
+		// The brick is released instead if all values are negligible.
+		void writeTile(uint brick, const float* values, const float* gradient = nullptr);
+
+		// Adds one tile to the brick like writeTile() stores it. Negligible tiles leave the brick as it is.
+		void addTile(uint brick, const float* values, const float* gradient = nullptr);
+
+		// Releases all bricks that only contain negligible values.
+		void compact();
+
+		// Replaces the contents with dense data of the full dimensions, which has data_channels floats per voxel.
+		void fromDense(const float* data, int data_channels);
+
+		// Replaces layer_count layers of bricks from first_layer on, data only covers the voxels of those layers.
+		void fromDenseLayers(const float* data, int data_channels, int first_layer, int layer_count);
+
+		// Copies all voxels into the texture, which must have the same dimensions. Creates the OpenGL texture if there is none.
+		// Channels beyond those of the bricks are zero. Half float textures are converted on the CPU, which halves the data sent to the GPU.
+		void upload(fgr::TextureHandle3D& texture) const;
+
+	private:
+		// Largest magnitude of the values of a tile within the dimensions.
+		float tileMagnitude(uint brick, const float* values) const;
+	};
+}
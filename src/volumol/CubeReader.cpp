@@ -11,6 +11,7 @@
 namespace mol {
 	extern CubeMap cubemap;
 	extern std::vector<ContractedBasis> basis_set;
+	extern std::vector<Shell> shells;
 	extern std::vector<MolecularOrbital> mos;
 }
 
@@ -19,8 +20,11 @@ namespace mol::Cub {
 
 	void readFile() {
 		Molecule molecule;
+		cancelRefinement();
 		basis_set.clear();
+		shells.clear();
 		mos.clear();
+		clearAOCache();
 
 		setLineNumber(2);
 
@@ -79,7 +83,11 @@ namespace mol::Cub {
 		
 		glm::mat3 transform_matrix = glm::mat3(glm::normalize(axes[0]), glm::normalize(axes[1]), glm::normalize(axes[2]));
 		cubemap.resize(resolution);
+		cubemap.bricks.setChannels(1);
+		cubemap.bricks.clear();
 		cubemap.size = glm::vec3(glm::length(axes[0]) * resolution.x, glm::length(axes[1]) * resolution.y, glm::length(axes[2]) * resolution.z);
+		// The atoms are moved into the frame of the file instead.
+		cubemap.axes = glm::dmat3(1.0);
 
 		for (int i = 0; i < molecule.atoms.size(); ++i) {
 			skipWhitespace();
@@ -155,18 +163,12 @@ namespace mol::Cub {
 				skipWhitespace();
 			}
 
-			int z = i % resolution.x;
-			int y = i / resolution.x % resolution.y;
-			int x = i / (resolution.x * resolution.y);
-			int j = 4 * (x + resolution.x * (y + resolution.y * z));
-
-			cubemap.texture.data[j] = readFloat(error) / volume_norm;
+			int z = i % resolution.z;
+			int y = i / resolution.z % resolution.y;
+			int x = i / (resolution.z * resolution.y);
+			cubemap.bricks.set(glm::ivec3(x, y, z), readFloat(error) / volume_norm);
 			skipWhitespace();
 
-			cubemap.texture.data[j + 1] = 0.f;
-			cubemap.texture.data[j + 2] = 0.f;
-			cubemap.texture.data[j + 3] = 0.f;
-
 			if (error) {
 				throwError( "Error reading cubemap data");
 				return;
@@ -177,7 +179,7 @@ namespace mol::Cub {
 
 		Renderer::setMolecule(molecule);
 
-		if (!cubemap.texture.id) cubemap.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
-		else cubemap.texture.syncTexture();
+		cubemap.bricks.compact();
+		cubemap.upload();
 	}
 }
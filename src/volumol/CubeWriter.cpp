@@ -0,0 +1,137 @@
+#include "CubeWriter.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "Molecule.h"
+#include "MolRenderer.h"
+#include "Constants.h"
+#include "Settings.h"
+
+#include "../logic/ThreadPool.h"
+
+namespace mol::Cub {
+	// Writes value like printf(" %12.5E"), 13 characters without a terminating zero. printf itself makes up most of the time of writing a file.
+	void formatValue(double value, char* out) {
+		std::memcpy(out, "  0.00000E+00", 13);
+		if (value == 0.0 || !std::isfinite(value)) return;
+
+		if (value < 0.0) out[1] = '-';
+		value = std::abs(value);
+		int exponent = (int)std::floor(std::log10(value));
+		long long digits = (long long)std::nearbyint(value * std::pow(10.0, 5 - exponent));
+		if (digits >= 1000000) {
+			digits = (digits + 5) / 10;
+			++exponent;
+		}
+
+		out[2] = (char)('0' + digits / 100000);
+		for (int i = 8; i > 3; --i) {
+			out[i] = (char)('0' + digits % 10);
+			digits /= 10;
+		}
+		out[10] = exponent < 0 ? '-' : '+';
+		exponent = std::abs(exponent);
+		out[11] = (char)('0' + exponent / 10 % 10);
+		out[12] = (char)('0' + exponent % 10);
+	}
+
+	bool writeFile(const std::string& path, const CubeMap& map, const std::string& comment) {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			std::cout << "Could not open " << path << " for writing\n";
+			return false;
+		}
+
+		const glm::ivec3 resolution = map.bricks.dimensions;
+		const glm::dvec3 spacing = map.size / glm::dvec3(resolution) / a0_A;
+		// Cube files start at the first sample, which is the center of the first voxel.
+		const glm::dvec3 origin = map.origin / a0_A + 0.5 * spacing;
+		const std::vector<Atom>& atoms = Renderer::getMolecule().atoms;
+
+		char line[128];
+		file << "VoluMol\n" << comment << '\n';
+		snprintf(line, sizeof(line), "%5d %12.6f %12.6f %12.6f\n", (int)atoms.size(), origin.x, origin.y, origin.z);
+		file << line;
+		for (int i = 0; i < 3; ++i) {
+			glm::dvec3 axis(0.0);
+			axis[i] = spacing[i];
+			snprintf(line, sizeof(line), "%5d %12.6f %12.6f %12.6f\n", resolution[i], axis.x, axis.y, axis.z);
+			file << line;
+		}
+		for (const Atom& atom : atoms) {
+			const glm::dvec3 position = glm::dvec3(atom.position) / a0_A;
+			snprintf(line, sizeof(line), "%5d %12.6f %12.6f %12.6f %12.6f\n", atom.Z, (double)atom.Z, position.x, position.y, position.z);
+			file << line;
+		}
+
+		// Values are stored per cubic angstrom, which CubeReader undoes on reading.
+		const float volume_norm = glm::pow(a0_A, 1.5f);
+
+		// Planes of constant x are formatted in parallel and written in order, z runs fastest.
+		std::vector<std::string> planes(resolution.x);
+		flo::ThreadPool::global().parallelFor(resolution.x, [&](uint x) {
+			std::string& text = planes[x];
+			text.reserve(resolution.y * (13 * resolution.z + resolution.z / 6 + 1));
+			char value[13];
+			for (int y = 0; y < resolution.y; ++y) {
+				for (int z = 0; z < resolution.z; ++z) {
+					formatValue(map.bricks.value(glm::ivec3(x, y, z)) * volume_norm, value);
+					text.append(value, 13);
+					if (z % 6 == 5 || z == resolution.z - 1) text += '\n';
+				}
+			}
+		});
+		for (const std::string& plane : planes) file << plane;
+
+		return true;
+	}
+
+	bool exportMOs(const std::vector<uint>& orbitals, const std::vector<std::string>& paths, glm::ivec3 resolution, glm::dvec3 origin, glm::dvec3 size) {
+		if (orbitals.size() != paths.size()) {
+			std::cout << "Expected one path per orbital\n";
+			return false;
+		}
+		if (orbitals.empty()) return true;
+		for (uint orbital : orbitals) {
+			if (orbital >= MOcount()) {
+				std::cout << "There is no orbital " << orbital << '\n';
+				return false;
+			}
+		}
+
+		std::vector<CubeMap> maps(orbitals.size());
+		if (size == glm::dvec3(0.0)) fitExportMap(maps[0], resolution);
+		else {
+			maps[0].origin = origin;
+			maps[0].size = size;
+			maps[0].resize(resolution == glm::ivec3(0) ? glm::ivec3((glm::vec3)size * settings.cubemap_density) : resolution);
+		}
+
+		std::vector<CubeMap*> pointers;
+		for (CubeMap& map : maps) {
+			map.origin = maps[0].origin;
+			map.size = maps[0].size;
+			map.resize(maps[0].bricks.dimensions);
+			pointers.push_back(&map);
+		}
+
+		writeMOCubeMaps(orbitals, pointers);
+
+		// Each map is dropped once its file is written.
+		uint failed = 0;
+		for (uint i = 0; i < orbitals.size(); ++i) {
+			const MolecularOrbital& mo = getMO(orbitals[i]);
+			char comment[128];
+			snprintf(comment, sizeof(comment), "MO %u %s, energy %.6f, occupation %.4f", orbitals[i], mo.name.c_str(), mo.energy, mo.occupation);
+			if (!writeFile(paths[i], maps[i], comment)) ++failed;
+			maps[i].bricks.clear();
+		}
+		std::cout << "Wrote " << orbitals.size() - failed << " cube files\n";
+		if (failed) std::cout << failed << " of " << orbitals.size() << " cube files could not be written\n";
+		return !failed;
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "Orbital.h"
+
+namespace mol::Cub {
+	// Writes map as a Gaussian cube file in atomic units, along with the atoms of the displayed molecule.
+	// Returns false if the file could not be opened.
+	bool writeFile(const std::string& path, const CubeMap& map, const std::string& comment);
+
+	// Evaluates all orbitals in one pass and writes orbitals[i] to paths[i], see writeMOCubeMaps().
+	// The grid spans size from origin with the given resolution. If size is zero, it is placed around the molecule like the cubemap.
+	// A resolution of zero follows cubemap_density. Returns false if the arguments are invalid or any file could not be written.
+	bool exportMOs(const std::vector<uint>& orbitals, const std::vector<std::string>& paths, glm::ivec3 resolution, glm::dvec3 origin, glm::dvec3 size);
+}
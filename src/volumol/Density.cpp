@@ -0,0 +1,273 @@
+#include "Density.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace mol {
+	// Absolute error in electrons per cubic bohr below which a pair of basis functions is neglected on a tile, if there is no tolerance.
+	constexpr double density_screening = 1e-10;
+
+	// Largest |P_ij| max |phi_i| max |phi_j| of a pair that may be skipped on a tile of count functions. Each skipped pair adds at most twice this
+	// to rho, so all count (count - 1) / 2 pairs together stay below tolerance.
+	double pairThreshold(double tolerance, uint count) {
+		if (tolerance <= 0.0 || count < 2) return density_screening;
+		return tolerance / ((double)count * (count - 1));
+	}
+
+	double channelOccupation(const MolecularOrbital& mo, DensityChannel channel) {
+		const double alpha = mo.spin == Spin::up ? glm::min(mo.occupation, 1.0) : 0.0;
+		const double beta = mo.occupation - alpha;
+		switch (channel) {
+		case DensityChannel::alpha:
+			return alpha;
+		case DensityChannel::beta:
+			return beta;
+		case DensityChannel::spin:
+			return alpha - beta;
+		default:
+			return mo.occupation;
+		}
+	}
+
+	DensityMatrix::DensityMatrix(const std::vector<MolecularOrbital>& mos, uint function_count, DensityChannel channel) :
+	size(function_count), values(function_count * function_count, 0.0) {
+		for (const MolecularOrbital& mo : mos) {
+			const double occupation = channelOccupation(mo, channel);
+			if (occupation < 0.001 && occupation > -0.001) continue;
+
+			const std::vector<double>& c = mo.lcao_coefficients;
+			const uint count = glm::min((uint)c.size(), size);
+			occupations.push_back(occupation);
+			for (uint i = 0; i < count; ++i) {
+				if (c[i] == 0.0) continue;
+				const double w = occupation * c[i];
+				double* row = values.data() + i * size;
+				for (uint j = 0; j <= i; ++j) row[j] += w * c[j];
+			}
+		}
+
+		for (uint i = 0; i < size; ++i) {
+			for (uint j = 0; j < i; ++j) values[j * size + i] = values[i * size + j];
+		}
+
+		const uint orbital_count = occupations.size();
+		coefficients.resize(size * orbital_count, 0.0);
+		uint j = 0;
+		for (const MolecularOrbital& mo : mos) {
+			const double occupation = channelOccupation(mo, channel);
+			if (occupation < 0.001 && occupation > -0.001) continue;
+			const uint count = glm::min((uint)mo.lcao_coefficients.size(), size);
+			for (uint i = 0; i < count; ++i) coefficients[i * orbital_count + j] = mo.lcao_coefficients[i];
+			++j;
+		}
+	}
+
+	double DensityMatrix::at(uint i, uint j) const {
+		return values[i * size + j];
+	}
+
+	std::vector<double> screeningWeights(const DensityMatrix& density, const std::vector<ContractedBasis>& basis) {
+		const uint count = glm::min(density.size, (uint)basis.size());
+		std::vector<double> peaks(count);
+		for (uint j = 0; j < count; ++j) peaks[j] = boundPeak(basisBound(basis[j]));
+
+		std::vector<double> weights(basis.size(), 0.0);
+		for (uint i = 0; i < count; ++i) {
+			const double* row = density.values.data() + i * density.size;
+			for (uint j = 0; j < count; ++j) weights[i] += std::abs(row[j]) * peaks[j];
+			weights[i] *= 2.0;
+		}
+		return weights;
+	}
+
+	template<typename T>
+	void addTileOrbitals(const DensityMatrix& density, const std::vector<uint>& functions, const T* values, float* rho, float* gradient) {
+		const uint orbital_count = density.occupations.size();
+		const int planes = gradient ? 4 : 1;
+
+		// psi followed by its gradient if there is one.
+		std::vector<T> psi(planes * tile_voxels);
+		for (uint j = 0; j < orbital_count; ++j) {
+			std::fill(psi.begin(), psi.end(), (T)0.0);
+			for (uint i = 0; i < functions.size(); ++i) {
+				if (functions[i] >= density.size) continue;
+				const double c = density.coefficients[functions[i] * orbital_count + j];
+				if (c == 0.0) continue;
+
+				const T w = (T)c;
+				const T* phi = values + i * planes * tile_voxels;
+				for (int v = 0; v < planes * tile_voxels; ++v) psi[v] += w * phi[v];
+			}
+
+			const T occupation = (T)density.occupations[j];
+			for (int v = 0; v < tile_voxels; ++v) rho[v] += (float)(occupation * psi[v] * psi[v]);
+			if (!gradient) continue;
+
+			// grad rho = sum_j 2 n_j psi_j grad psi_j
+			for (int v = 0; v < 3 * tile_voxels; ++v) gradient[v] += (float)((T)2.0 * occupation * psi[v % tile_voxels] * psi[tile_voxels + v]);
+		}
+	}
+
+	// grad rho = 2 sum_i grad phi_i sum_j P_ij phi_j, which needs the full rows of P rather than the pairs j < i.
+	template<typename T>
+	void addTileDensityGradient(const DensityMatrix& density, const std::vector<uint>& functions, const T* values, const std::vector<double>& magnitude, double threshold, float* rho, float* gradient) {
+		const uint count = functions.size();
+
+		alignas(64) T sum[tile_voxels];
+		for (uint i = 0; i < count; ++i) {
+			if (functions[i] >= density.size || magnitude[i] == 0.0) continue;
+
+			const double* row = density.values.data() + functions[i] * density.size;
+			for (int v = 0; v < tile_voxels; ++v) sum[v] = (T)0.0;
+			for (uint j = 0; j < count; ++j) {
+				if (functions[j] >= density.size) continue;
+				const double p = row[functions[j]];
+				if (std::abs(p) * magnitude[i] * magnitude[j] < threshold) continue;
+
+				const T w = (T)p;
+				const T* phj = values + 4 * j * tile_voxels;
+				for (int v = 0; v < tile_voxels; ++v) sum[v] += w * phj[v];
+			}
+
+			const T* phi = values + 4 * i * tile_voxels;
+			for (int v = 0; v < tile_voxels; ++v) rho[v] += (float)(phi[v] * sum[v]);
+			for (int v = 0; v < 3 * tile_voxels; ++v) gradient[v] += (float)((T)2.0 * phi[tile_voxels + v] * sum[v % tile_voxels]);
+		}
+	}
+
+	template<typename T>
+	void addTileDensity(const DensityMatrix& density, const std::vector<uint>& functions, const T* values, double tolerance, float* rho, float* gradient) {
+		const uint count = functions.size();
+		if (count > 2 * density.occupations.size()) {
+			addTileOrbitals(density, functions, values, rho, gradient);
+			return;
+		}
+
+		const int planes = gradient ? 4 : 1;
+		std::vector<double> magnitude(count);
+		for (uint i = 0; i < count; ++i) {
+			const T* phi = values + i * planes * tile_voxels;
+			T m = (T)0.0;
+			for (int v = 0; v < tile_voxels; ++v) m = std::max(m, std::abs(phi[v]));
+			magnitude[i] = m;
+		}
+
+		const double threshold = pairThreshold(tolerance, count);
+		if (gradient) {
+			addTileDensityGradient(density, functions, values, magnitude, threshold, rho, gradient);
+			return;
+		}
+
+		// rho = sum_i phi_i (P_ii phi_i + 2 sum_{j<i} P_ij phi_j), so that each pair is only visited once.
+		alignas(64) T sum[tile_voxels];
+		for (uint i = 0; i < count; ++i) {
+			if (functions[i] >= density.size || magnitude[i] == 0.0) continue;
+
+			const double* row = density.values.data() + functions[i] * density.size;
+			const T* phi = values + i * tile_voxels;
+			const T diagonal = (T)(0.5 * row[functions[i]]);
+			for (int v = 0; v < tile_voxels; ++v) sum[v] = diagonal * phi[v];
+
+			for (uint j = 0; j < i; ++j) {
+				if (functions[j] >= density.size) continue;
+				const double p = row[functions[j]];
+				if (std::abs(p) * magnitude[i] * magnitude[j] < threshold) continue;
+
+				const T w = (T)p;
+				const T* phj = values + j * tile_voxels;
+				for (int v = 0; v < tile_voxels; ++v) sum[v] += w * phj[v];
+			}
+
+			for (int v = 0; v < tile_voxels; ++v) rho[v] += (float)((T)2.0 * phi[v] * sum[v]);
+		}
+	}
+
+	template void addTileDensity<float>(const DensityMatrix& density, const std::vector<uint>& functions, const float* values, double tolerance, float* rho, float* gradient);
+	template void addTileDensity<double>(const DensityMatrix& density, const std::vector<uint>& functions, const double* values, double tolerance, float* rho, float* gradient);
+
+	template<typename T>
+	void storeTileDensity(const DensityMatrix& density, uint tile, const std::vector<uint>& functions, const T* values, double tolerance, bool gradients, BrickMap& bricks, bool add) {
+		alignas(64) float rho[tile_voxels];
+		for (int v = 0; v < tile_voxels; ++v) rho[v] = 0.f;
+		std::vector<float> gradient(gradients ? 3 * tile_voxels : 0, 0.f);
+		addTileDensity(density, functions, values, tolerance, rho, gradients ? gradient.data() : nullptr);
+		if (add) bricks.addTile(tile, rho, gradients ? gradient.data() : nullptr);
+		else bricks.writeTile(tile, rho, gradients ? gradient.data() : nullptr);
+	}
+
+	template void storeTileDensity<float>(const DensityMatrix& density, uint tile, const std::vector<uint>& functions, const float* values, double tolerance, bool gradients, BrickMap& bricks, bool add);
+	template void storeTileDensity<double>(const DensityMatrix& density, uint tile, const std::vector<uint>& functions, const double* values, double tolerance, bool gradients, BrickMap& bricks, bool add);
+
+	// Evaluates the basis functions of a tile once and stores each density from them into the bricks of the same position.
+	template<typename T>
+	void writeDensityTile(const GridEvaluator& evaluator, const std::vector<const DensityMatrix*>& densities, uint tile, double tolerance, const std::vector<BrickMap*>& bricks, bool add) {
+		const glm::ivec3 min = evaluator.grid.tileMin(tile);
+		const glm::ivec3 max = evaluator.grid.tileMax(tile);
+
+		std::vector<uint> list, functions;
+		std::vector<T> values;
+		evaluator.listFunctions(min, max, list);
+		evaluator.evaluateFunctions(min, max, list, functions, values);
+
+		for (uint i = 0; i < densities.size(); ++i) storeTileDensity(*densities[i], tile, functions, values.data(), tolerance, evaluator.gradients, *bricks[i], add);
+	}
+
+	GridEvaluator densityEvaluator(const std::vector<const DensityMatrix*>& densities, const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells,
+		const EvaluationSettings& options) {
+		// Basis functions are evaluated with unit coefficients, the density matrix takes the place of the LCAO coefficients.
+		// Each density is screened on its own terms, the evaluator follows the one that needs the largest extents.
+		std::vector<double> weights(basis.size(), 0.0);
+		if (options.tolerance > 0.0) {
+			for (const DensityMatrix* density : densities) {
+				const std::vector<double> density_weights = screeningWeights(*density, basis);
+				for (uint i = 0; i < weights.size(); ++i) weights[i] = glm::max(weights[i], density_weights[i]);
+			}
+		}
+		return GridEvaluator(map, basis, shells, std::vector<double>(basis.size(), 1.0), options.separable, true, options.tolerance, &weights);
+	}
+
+	void writeDensityTiles(const GridEvaluator& evaluator, const std::vector<const DensityMatrix*>& densities, const std::vector<BrickMap*>& bricks, const std::vector<uint>* tiles,
+		bool add, const EvaluationSettings& options, const std::atomic<bool>* cancel) {
+		forEachTile(tiles ? tiles->size() : evaluator.grid.size(), [&](uint i) {
+			const uint tile = tiles ? (*tiles)[i] : i;
+			if (options.single_precision) writeDensityTile<float>(evaluator, densities, tile, options.tolerance, bricks, add);
+			else writeDensityTile<double>(evaluator, densities, tile, options.tolerance, bricks, add);
+		}, cancel);
+	}
+
+	void writeDensities(const std::vector<const DensityMatrix*>& densities, const CubeMap& map, const std::vector<BrickMap*>& bricks,
+		const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<uint>* tiles, bool add, const EvaluationSettings& options, const std::atomic<bool>* cancel) {
+		writeDensityTiles(densityEvaluator(densities, map, basis, shells, options), densities, bricks, tiles, add, options, cancel);
+	}
+
+	void writeDensity(const DensityMatrix& density, CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<uint>* tiles, bool add,
+		const EvaluationSettings& options, const std::atomic<bool>* cancel) {
+		writeDensities({ &density }, map, { &map.bricks }, basis, shells, tiles, add, options, cancel);
+	}
+
+	void writeSpinDensity(const DensityMatrix& total, const DensityMatrix& spin, const CubeMap& map, BrickMap& total_bricks, BrickMap& spin_bricks,
+		const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<uint>* tiles, bool add, const EvaluationSettings& options) {
+		writeDensities({ &total, &spin }, map, { &total_bricks, &spin_bricks }, basis, shells, tiles, add, options, nullptr);
+	}
+
+	void composeDensity(const BrickMap& total, const BrickMap& spin, DensityChannel channel, BrickMap& out, const std::vector<uint>* tiles) {
+		float a = 1.f, b = 0.f;
+		if (channel == DensityChannel::alpha) a = b = 0.5f;
+		else if (channel == DensityChannel::beta) a = 0.5f, b = -0.5f;
+		else if (channel == DensityChannel::spin) a = 0.f, b = 1.f;
+
+		const int length = total.channels * tile_voxels;
+		forEachTile(tiles ? tiles->size() : total.bricks.size(), [&](uint i) {
+			const uint brick = tiles ? (*tiles)[i] : i;
+			const float* t = a != 0.f ? total.bricks[brick].get() : nullptr;
+			const float* s = b != 0.f ? spin.bricks[brick].get() : nullptr;
+			if (!t && !s) {
+				out.release(brick);
+				return;
+			}
+
+			float* data = out.allocate(brick);
+			for (int v = 0; v < length; ++v) data[v] = (t ? a * t[v] : 0.f) + (s ? b * s[v] : 0.f);
+		});
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+
+#include "GridEvaluator.h"
+
+namespace mol {
+	// Fields that the electron density can be split into, rho = rho_alpha + rho_beta and the spin density rho_alpha - rho_beta.
+	enum class DensityChannel {
+		total = 0,
+		alpha = 1,
+		beta = 2,
+		spin = 3,
+	};
+
+	// Share of the occupation of an orbital in the channel. Spin up orbitals hold up to one alpha electron, the rest of their occupation
+	// is counted as beta, which covers doubly occupied orbitals of restricted calculations. Spin down orbitals only hold beta electrons.
+	double channelOccupation(const MolecularOrbital& mo, DensityChannel channel);
+
+	// The one-particle density matrix P = C diag(n) C^T of the occupied orbitals, in the basis of the atomic orbitals.
+	// The electron density is then rho = sum_ij P_ij phi_i phi_j, which does not grow with the number of orbitals.
+	// The occupied orbitals are kept as well, tiles that overlap more basis functions than twice the number of orbitals are cheaper to evaluate from them.
+	struct DensityMatrix {
+		uint size = 0;
+		std::vector<double> values;
+		std::vector<double> occupations;
+		// Coefficient of basis function i in occupied orbital j at i * occupations.size() + j.
+		std::vector<double> coefficients;
+
+		DensityMatrix() = default;
+
+		// Orbitals are weighted by their share of the occupation in channel.
+		DensityMatrix(const std::vector<MolecularOrbital>& mos, uint function_count, DensityChannel channel = DensityChannel::total);
+
+		double at(uint i, uint j) const;
+	};
+
+	// Factor by which an error in each basis function enters the density, 2 sum_j |P_ij| max |phi_j|, for screening with GridEvaluator.
+	std::vector<double> screeningWeights(const DensityMatrix& density, const std::vector<ContractedBasis>& basis);
+
+	// Adds the density of one tile to rho. values holds tile_voxels values of the basis function functions[i] at i * tile_voxels.
+	// If gradient is given, values also holds the x, y and z derivatives after the values of each function, as GridEvaluator::evaluateFunctions
+	// writes them with gradients, and the three planes of the density gradient are added to gradient.
+	// Pairs of basis functions are skipped if their contribution stays small everywhere on the tile, so that all skipped pairs together add less
+	// than tolerance to rho. With a tolerance of 0, pairs below a fixed 1e-10 are skipped.
+	template<typename T>
+	void addTileDensity(const DensityMatrix& density, const std::vector<uint>& functions, const T* values, double tolerance, float* rho, float* gradient = nullptr);
+
+	// Evaluates the density of one tile with addTileDensity() and writes it into the brick of the same index, or adds it if add is set.
+	template<typename T>
+	void storeTileDensity(const DensityMatrix& density, uint tile, const std::vector<uint>& functions, const T* values, double tolerance, bool gradients, BrickMap& bricks, bool add);
+
+	// Builds the evaluator for writeDensityTiles(), with unit coefficients and screened for the largest extents any of the densities needs.
+	// Evaluators can be kept for several calls on the same map, as long as its dimensions and channels stay the same.
+	GridEvaluator densityEvaluator(const std::vector<const DensityMatrix*>& densities, const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells,
+		const EvaluationSettings& options = evaluationSettings());
+
+	// Writes each density into the bricks of the same index from one evaluation of the basis functions per tile, see writeDensity().
+	void writeDensityTiles(const GridEvaluator& evaluator, const std::vector<const DensityMatrix*>& densities, const std::vector<BrickMap*>& bricks, const std::vector<uint>* tiles = nullptr,
+		bool add = false, const EvaluationSettings& options = evaluationSettings(), const std::atomic<bool>* cancel = nullptr);
+
+	// Evaluates the electron density on the map tile by tile, from the basis functions that overlap each tile.
+	// If tiles is given, only those tiles are written. If add is set, the density is added to the values in the map.
+	// Once cancel is set, the remaining tiles are skipped.
+	void writeDensity(const DensityMatrix& density, CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<uint>* tiles = nullptr, bool add = false,
+		const EvaluationSettings& options = evaluationSettings(), const std::atomic<bool>* cancel = nullptr);
+
+	// Writes the total and the spin density in one pass like writeDensity(), both from the same evaluation of the basis functions of each tile.
+	// The bricks must have the dimensions and channels of the map, whose grid is used.
+	void writeSpinDensity(const DensityMatrix& total, const DensityMatrix& spin, const CubeMap& map, BrickMap& total_bricks, BrickMap& spin_bricks,
+		const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<uint>* tiles = nullptr, bool add = false,
+		const EvaluationSettings& options = evaluationSettings());
+
+	// Combines the total and the spin density into one channel, rho_alpha = (rho + rho_s) / 2 and rho_beta = (rho - rho_s) / 2.
+	// Gradients are combined alike. If tiles is given, only those bricks are written.
+	void composeDensity(const BrickMap& total, const BrickMap& spin, DensityChannel channel, BrickMap& out, const std::vector<uint>* tiles = nullptr);
+}
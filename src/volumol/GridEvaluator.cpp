@@ -0,0 +1,826 @@
+#include "GridEvaluator.h"
+
+#include "Settings.h"
+#include "../logic/SIMD.h"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+namespace mol {
+	EvaluationSettings evaluationSettings() {
+		EvaluationSettings result;
+		result.separable = settings.cubemap_separable;
+		result.single_precision = settings.cubemap_single_precision;
+		result.tolerance = settings.cubemap_tolerance;
+		return result;
+	}
+
+	TileGrid::TileGrid(const CubeMap& map) {
+		dimensions = glm::ivec3(map.texture.width, map.texture.height, map.texture.depth);
+		tile_count = (dimensions + glm::ivec3(tile_width, tile_size, tile_size) - 1) / glm::ivec3(tile_width, tile_size, tile_size);
+		origin = map.origin;
+		spacing = map.size / glm::dvec3(dimensions);
+	}
+
+	uint TileGrid::size() const {
+		return tile_count.x * tile_count.y * tile_count.z;
+	}
+
+	glm::ivec3 TileGrid::tileMin(uint tile) const {
+		return glm::ivec3(tile_width, tile_size, tile_size) * glm::ivec3(tile % tile_count.x, tile / tile_count.x % tile_count.y, tile / (tile_count.x * tile_count.y));
+	}
+
+	glm::ivec3 TileGrid::tileMax(uint tile) const {
+		return glm::min(tileMin(tile) + glm::ivec3(tile_width, tile_size, tile_size), dimensions);
+	}
+
+	glm::dvec3 TileGrid::position(const glm::ivec3& voxel) const {
+		return origin + spacing * (glm::dvec3(voxel) + 0.5);
+	}
+
+	double basisRadius(const ContractedBasis& basis) {
+		double radius = 0.0;
+		for (const STO& primitive : basis.sto_primitives) {
+			double r = 2.5 / primitive.alpha + (double)(glm::max(primitive.e_x, glm::max(primitive.e_y, primitive.e_z)) * primitive.e_r);
+			if (r > radius) radius = r;
+		}
+		for (const GTO& primitive : basis.gto_primitives) {
+			double r = 2.5 / glm::sqrt(primitive.e_r) + (double)glm::max(primitive.e_x, glm::max(primitive.e_y, primitive.e_z));
+			if (r > radius) radius = r;
+		}
+		return radius;
+	}
+
+	double boundValue(const std::vector<RadialBound>& terms, double r) {
+		double result = 0.0;
+		for (const RadialBound& t : terms) result += t.c * std::pow(r, t.n) * std::exp(-t.a * (t.q == 1 ? r : r * r));
+		return result;
+	}
+
+	double boundPeak(const std::vector<RadialBound>& terms) {
+		// r^n exp(-a r^q) peaks at r^q = n / (q a).
+		double result = 0.0;
+		for (const RadialBound& t : terms) {
+			const double r = t.n ? std::pow(t.n / (t.q * t.a), 1.0 / t.q) : 0.0;
+			result += t.c * std::pow(r, t.n) * std::exp(-t.a * (t.q == 1 ? r : r * r));
+		}
+		return result;
+	}
+
+	double screeningRadius(const std::vector<RadialBound>& terms, double limit) {
+		if (boundPeak(terms) < limit) return 0.0;
+
+		// Beyond the last peak of the terms their sum only decreases, the radius is found by bisection from there.
+		double low = 0.0;
+		for (const RadialBound& t : terms) low = glm::max(low, t.n ? std::pow(t.n / (t.q * t.a), 1.0 / t.q) : 0.0);
+		double high = glm::max(2.0 * low, 1.0);
+		while (boundValue(terms, high) > limit && high < 1e4) {
+			low = high;
+			high *= 2.0;
+		}
+		for (int i = 0; i < 32; ++i) {
+			const double r = 0.5 * (low + high);
+			if (boundValue(terms, r) > limit) low = r;
+			else high = r;
+		}
+		return high;
+	}
+
+	std::vector<RadialBound> basisBound(const ContractedBasis& basis) {
+		// |x^i y^j z^k| <= r^(i+j+k)
+		std::vector<RadialBound> terms;
+		for (const GTO& p : basis.gto_primitives) {
+			if (p.coeff != 0.0) terms.push_back(RadialBound{ std::abs(p.coeff), p.e_x + p.e_y + p.e_z, p.e_r, 2 });
+		}
+		for (const STO& p : basis.sto_primitives) {
+			if (p.coeff != 0.0) terms.push_back(RadialBound{ std::abs(p.coeff), p.e_r + p.e_x + p.e_y + p.e_z, 2.0 * p.alpha, 1 });
+		}
+		return terms;
+	}
+
+	// Interpolation error of radial tables relative to the largest value of the function.
+	constexpr double radial_table_error = 1e-10;
+
+	RadialTable::RadialTable(double a, int n) :
+	a(a), n(n) {
+		const double peak = exact(n / a);
+		// Beyond range, the function stays below what doubles resolve next to its peak.
+		const double range = screeningRadius({ RadialBound{ 1.0, n, a, 1 } }, 1e-16 * peak);
+
+		for (double spacing = 1.0 / a;; spacing *= 0.5) {
+			const uint count = (uint)std::ceil(range / spacing) + 2;
+			values.resize(count);
+			slopes.resize(count);
+			for (uint k = 0; k < count; ++k) {
+				const double R = k * spacing;
+				values[k] = exact(R);
+				// d/dR R^n exp(-a R) = (n R^(n-1) - a R^n) exp(-a R)
+				slopes[k] = spacing * ((n ? n * std::pow(R, n - 1) * std::exp(-a * R) : 0.0) - a * values[k]);
+			}
+			inverse_spacing = 1.0 / spacing;
+
+			double error = 0.0;
+			for (uint k = 0; k + 1 < count; ++k) {
+				for (double t : { 0.25, 0.5, 0.75 }) {
+					const double R = (k + t) * spacing;
+					double value;
+					lookup<double, 1>(&R, &value, nullptr);
+					error = glm::max(error, std::abs(value - exact(R)));
+				}
+			}
+			if (error <= radial_table_error * peak || count > (1u << 20)) break;
+		}
+	}
+
+	double RadialTable::exact(double R) const {
+		return std::pow(R, n) * std::exp(-a * R);
+	}
+
+	template<typename T, int N>
+	FLO_INLINE void RadialTable::lookup(const T* R, T* value, T* derivative) const {
+		const int last = (int)values.size() - 1;
+		for (int i = 0; i < N; ++i) {
+			const T u = R[i] * (T)inverse_spacing;
+			const int k = (int)u;
+			if (k >= last) {
+				value[i] = (T)0.0;
+				if (derivative) derivative[i] = (T)0.0;
+				continue;
+			}
+
+			// Cubic Hermite interpolation between the nodes k and k + 1.
+			const T t = u - (T)k, s = (T)1.0 - t;
+			const T y0 = (T)values[k], y1 = (T)values[k + 1], m0 = (T)slopes[k], m1 = (T)slopes[k + 1];
+			value[i] = s * s * (((T)1.0 + (T)2.0 * t) * y0 + t * m0) + t * t * (((T)3.0 - (T)2.0 * t) * y1 - s * m1);
+			if (derivative) derivative[i] = ((T)6.0 * t * s * (y1 - y0) + s * ((T)1.0 - (T)3.0 * t) * m0 + t * ((T)3.0 * t - (T)2.0) * m1) * (T)inverse_spacing;
+		}
+	}
+
+	GridEvaluator::GridEvaluator(const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<double>& coefficients,
+		bool separable, bool per_function, double tolerance, const std::vector<double>* weights) :
+	grid(map), gradients(map.bricks.hasGradients()) {
+		const uint ao_count = glm::min(coefficients.size(), basis.size());
+		std::vector<bool> covered(ao_count, false);
+
+		if (shells) {
+			for (const Shell& shell : *shells) {
+				BasisExtent f;
+				f.origin = shell.origin;
+				f.first_term = terms.size();
+				for (uint i = 0; i < shell.components.size(); ++i) {
+					const uint index = shell.first_function + i;
+					if (index >= ao_count) break;
+					covered[index] = true;
+					if (coefficients[index] == 0.0) continue;
+
+					if (per_function) {
+						BasisExtent g = f;
+						g.function = index;
+						for (const ShellTerm& t : shell.components[i]) terms.push_back(ShellTerm{ t.e_x, t.e_y, t.e_z, coefficients[index] * t.weight });
+						g.term_count = terms.size() - g.first_term;
+						g.first_primitive = primitives.size();
+						g.primitive_count = shell.primitives.size();
+						primitives.insert(primitives.end(), shell.primitives.begin(), shell.primitives.end());
+						addGaussian(g, separable);
+						f.first_term = terms.size();
+						continue;
+					}
+
+					for (const ShellTerm& t : shell.components[i]) {
+						uint j = f.first_term;
+						while (j < terms.size() && (terms[j].e_x != t.e_x || terms[j].e_y != t.e_y || terms[j].e_z != t.e_z)) ++j;
+						if (j == terms.size()) terms.push_back(ShellTerm{ t.e_x, t.e_y, t.e_z, 0.0 });
+						terms[j].weight += coefficients[index] * t.weight;
+					}
+				}
+				f.term_count = terms.size() - f.first_term;
+				if (!f.term_count) continue;
+
+				f.first_primitive = primitives.size();
+				f.primitive_count = shell.primitives.size();
+				primitives.insert(primitives.end(), shell.primitives.begin(), shell.primitives.end());
+				addGaussian(f, separable);
+			}
+		}
+
+		// Slater type orbitals are gathered by center, unless basis functions are kept apart.
+		std::vector<glm::dvec3> slater_centers;
+		std::vector<std::vector<const ContractedBasis*>> slater_basis;
+		std::vector<std::vector<double>> slater_coefficients;
+
+		for (uint i = 0; i < ao_count; ++i) {
+			if (covered[i] || coefficients[i] == 0.0) continue;
+
+			if (basis[i].sto_primitives.size()) {
+				if (per_function) addSlater(basis[i].origin, { &basis[i] }, { coefficients[i] }, i);
+				else {
+					uint center = 0;
+					while (center < slater_centers.size() && slater_centers[center] != basis[i].origin) ++center;
+					if (center == slater_centers.size()) {
+						slater_centers.push_back(basis[i].origin);
+						slater_basis.emplace_back();
+						slater_coefficients.emplace_back();
+					}
+					slater_basis[center].push_back(&basis[i]);
+					slater_coefficients[center].push_back(coefficients[i]);
+				}
+			}
+
+			// Basis functions outside of shells are split up by exponent, each exponent becomes a shell of its own.
+			const std::vector<GTO>& gtos = basis[i].gto_primitives;
+			for (uint j = 0; j < gtos.size(); ++j) {
+				bool seen = false;
+				for (uint k = 0; k < j; ++k) seen |= gtos[k].e_r == gtos[j].e_r;
+				if (seen) continue;
+
+				BasisExtent f;
+				f.origin = basis[i].origin;
+				f.function = per_function ? i : -1;
+				f.first_term = terms.size();
+				for (uint k = j; k < gtos.size(); ++k) {
+					if (gtos[k].e_r == gtos[j].e_r) terms.push_back(ShellTerm{ gtos[k].e_x, gtos[k].e_y, gtos[k].e_z, coefficients[i] * gtos[k].coeff });
+				}
+				f.term_count = terms.size() - f.first_term;
+				f.first_primitive = primitives.size();
+				f.primitive_count = 1;
+				primitives.push_back(glm::dvec2(gtos[j].e_r, 1.0));
+				addGaussian(f, separable);
+			}
+		}
+		for (uint center = 0; center < slater_centers.size(); ++center) addSlater(slater_centers[center], slater_basis[center], slater_coefficients[center], -1);
+
+		kept = functions.size();
+		if (tolerance > 0.0) screen(tolerance, weights);
+	}
+
+	std::vector<RadialBound> GridEvaluator::extentBound(const BasisExtent& f) const {
+		if (f.first_group >= 0) {
+			std::vector<RadialBound> result;
+			for (uint g = f.first_group; g < f.first_group + f.group_count; ++g) {
+				const RadialTable& table = radial_tables[slater_groups[g].table];
+				for (uint t = slater_groups[g].first_term; t < slater_groups[g].first_term + slater_groups[g].term_count; ++t) {
+					result.push_back(RadialBound{ std::abs(terms[t].weight), table.n + terms[t].e_x + terms[t].e_y + terms[t].e_z, table.a, 1 });
+				}
+			}
+			return result;
+		}
+
+		// Terms of the same degree share one bound per primitive.
+		std::vector<double> degrees;
+		for (uint t = f.first_term; t < f.first_term + f.term_count; ++t) {
+			const uint n = terms[t].e_x + terms[t].e_y + terms[t].e_z;
+			if (degrees.size() <= n) degrees.resize(n + 1, 0.0);
+			degrees[n] += std::abs(terms[t].weight);
+		}
+		std::vector<RadialBound> result;
+		for (uint p = f.first_primitive; p < f.first_primitive + f.primitive_count; ++p) {
+			for (uint n = 0; n < degrees.size(); ++n) {
+				if (degrees[n] != 0.0 && primitives[p].y != 0.0) result.push_back(RadialBound{ std::abs(primitives[p].y) * degrees[n], (int)n, primitives[p].x, 2 });
+			}
+		}
+		return result;
+	}
+
+	void GridEvaluator::screen(double tolerance, const std::vector<double>* weights) {
+		const double share = tolerance / glm::max((double)functions.size(), 1.0);
+
+		std::vector<BasisExtent> screened;
+		for (BasisExtent& f : functions) {
+			const double weight = weights && f.function >= 0 && f.function < (int)weights->size() ? (*weights)[f.function] : 1.0;
+			f.radius = weight > 0.0 ? screeningRadius(extentBound(f), share / weight) : 0.0;
+			if (f.radius > 0.0) screened.push_back(f);
+		}
+		dropped = functions.size() - screened.size();
+		kept = screened.size();
+		functions.swap(screened);
+	}
+
+	void GridEvaluator::addGaussian(BasisExtent& f, bool separable) {
+		for (uint i = f.first_term; i < f.first_term + f.term_count; ++i) {
+			f.max_exponent = glm::max(f.max_exponent, glm::max(terms[i].e_x, glm::max(terms[i].e_y, terms[i].e_z)));
+		}
+		for (uint i = f.first_primitive; i < f.first_primitive + f.primitive_count; ++i) {
+			f.radius = glm::max(f.radius, 2.5 / glm::sqrt(primitives[i].x) + (double)f.max_exponent);
+		}
+		if (separable) tabulateAxes(f);
+		functions.push_back(f);
+	}
+
+	void GridEvaluator::addSlater(const glm::dvec3& origin, const std::vector<const ContractedBasis*>& basis, const std::vector<double>& coefficients, int function) {
+		BasisExtent f;
+		f.origin = origin;
+		f.function = function;
+		f.first_group = slater_groups.size();
+
+		// Terms are collected per group first, so that the terms of each group end up consecutive.
+		std::vector<std::vector<ShellTerm>> group_terms;
+		for (uint b = 0; b < basis.size(); ++b) {
+			for (const STO& p : basis[b]->sto_primitives) {
+				if (p.coeff == 0.0) continue;
+
+				const uint table = radialTable(2.0 * p.alpha, p.e_r);
+				uint g = f.first_group;
+				while (g < slater_groups.size() && slater_groups[g].table != table) ++g;
+				if (g == slater_groups.size()) {
+					slater_groups.push_back(SlaterGroup{ table, 0, 0 });
+					group_terms.emplace_back();
+				}
+
+				std::vector<ShellTerm>& list = group_terms[g - f.first_group];
+				uint t = 0;
+				while (t < list.size() && (list[t].e_x != p.e_x || list[t].e_y != p.e_y || list[t].e_z != p.e_z)) ++t;
+				if (t == list.size()) list.push_back(ShellTerm{ p.e_x, p.e_y, p.e_z, 0.0 });
+				list[t].weight += coefficients[b] * p.coeff;
+
+				f.max_exponent = glm::max(f.max_exponent, glm::max(p.e_x, glm::max(p.e_y, p.e_z)));
+				f.radius = glm::max(f.radius, 2.5 / p.alpha + (double)(glm::max(p.e_x, glm::max(p.e_y, p.e_z)) * p.e_r));
+			}
+		}
+
+		f.group_count = slater_groups.size() - f.first_group;
+		if (!f.group_count) return;
+		for (uint g = 0; g < f.group_count; ++g) {
+			SlaterGroup& group = slater_groups[f.first_group + g];
+			group.first_term = terms.size();
+			group.term_count = group_terms[g].size();
+			terms.insert(terms.end(), group_terms[g].begin(), group_terms[g].end());
+		}
+		functions.push_back(f);
+	}
+
+	uint GridEvaluator::radialTable(double a, int n) {
+		for (uint i = 0; i < radial_tables.size(); ++i) {
+			if (radial_tables[i].a == a && radial_tables[i].n == n) return i;
+		}
+		radial_tables.emplace_back(a, n);
+		return radial_tables.size() - 1;
+	}
+
+	void GridEvaluator::tabulateAxes(BasisExtent& f) {
+		// Every primitive has a table for each power up to max_exponent along each axis, up to max_exponent + 1 with gradients.
+		// x tables are padded to whole tiles so that tile rows can be read without bounds checks.
+		const int width = grid.tile_count.x * tile_width;
+		const int powers = f.max_exponent + (gradients ? 2 : 1);
+		const int stride = powers * (width + grid.dimensions.y + grid.dimensions.z);
+
+		f.axis_table = (int)axis_tables.size();
+		axis_tables.resize(axis_tables.size() + stride * f.primitive_count, 0.0);
+
+		double* table = axis_tables.data() + f.axis_table;
+		for (uint p = f.first_primitive; p < f.first_primitive + f.primitive_count; ++p) {
+			const int sizes[3] = { grid.dimensions.x, grid.dimensions.y, grid.dimensions.z };
+			const int row_sizes[3] = { width, grid.dimensions.y, grid.dimensions.z };
+			double* axis = table;
+			for (int a = 0; a < 3; ++a) {
+				for (int i = 0; i < sizes[a]; ++i) {
+					double d = grid.origin[a] + grid.spacing[a] * (i + 0.5) - f.origin[a];
+					double value = glm::exp(-primitives[p].x * d * d);
+					for (int k = 0; k < powers; ++k) {
+						axis[k * row_sizes[a] + i] = value;
+						value *= d;
+					}
+				}
+				axis += powers * row_sizes[a];
+			}
+			table += stride;
+		}
+	}
+
+	void GridEvaluator::listFunctions(const glm::ivec3& min, const glm::ivec3& max, std::vector<uint>& list) const {
+		listFunctions(grid.position(min), grid.position(max - 1), list);
+	}
+
+	void GridEvaluator::listFunctions(const glm::dvec3& box_min, const glm::dvec3& box_max, std::vector<uint>& list) const {
+		list.clear();
+		for (uint i = 0; i < functions.size(); ++i) {
+			const BasisExtent& f = functions[i];
+			glm::dvec3 d = f.origin - glm::clamp(f.origin, box_min, box_max);
+			if (glm::dot(d, d) <= f.radius * f.radius) list.push_back(i);
+		}
+	}
+
+	template<typename T, uint Bytes>
+	FLO_INLINE void GridEvaluator::accumulateLanes(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const {
+		constexpr int N = flo::lane_count<T, Bytes>;
+		constexpr int max_power = 10;
+		static_assert(tile_width % N == 0, "Tile rows must split evenly into SIMD lanes.");
+
+		const glm::ivec3 extent = max - min;
+		const int chunks = (extent.x + N - 1) / N;
+
+		// Powers go one higher than the exponents for the derivatives of Gaussians.
+		alignas(64) T dx[N], r2[N], R[N], Q[N], px[max_power + 1][N], phi[N], arg[N], e[N];
+		alignas(64) T S[N], Qx[N], Qy[N], Qz[N], gx[N], gy[N], gz[N];
+		T py[max_power + 1], pz[max_power + 1];
+		py[0] = pz[0] = (T)1.0;
+		for (int i = 0; i < N; ++i) px[0][i] = (T)1.0;
+
+		const int table_width = grid.tile_count.x * tile_width;
+
+		const BasisExtent& f = functions[index];
+		const int powers = glm::min(f.max_exponent, max_power - 1);
+		const int table_powers = powers + 1 + (gradients ? 1 : 0);
+		const ShellTerm* f_terms = terms.data() + f.first_term;
+		const glm::dvec2* f_primitives = primitives.data() + f.first_primitive;
+
+		if (f.axis_table >= 0) {
+			const int stride = table_powers * (table_width + grid.dimensions.y + grid.dimensions.z);
+			const double* table = axis_tables.data() + f.axis_table;
+			for (uint p = 0; p < f.primitive_count; ++p) {
+				const double* tx = table + min.x;
+				const double* ty = table + table_powers * table_width + min.y;
+				const double* tz = table + table_powers * (table_width + grid.dimensions.y) + min.z;
+				// d/dx x^k exp(-a x^2) = k x^(k-1) exp(-a x^2) - 2a x^(k+1) exp(-a x^2), the same holds along y and z.
+				const double a2 = -2.0 * f_primitives[p].x;
+				for (int z = 0; z < extent.z; ++z) {
+					for (int y = 0; y < extent.y; ++y) {
+						// Collect the terms by their power of x, so that each row costs one multiply-add per power.
+						double a[max_power + 1], ax[max_power + 1], ay[max_power + 1], az[max_power + 1];
+						for (int k = 0; k < table_powers; ++k) a[k] = ax[k] = ay[k] = az[k] = 0.0;
+						for (uint t = 0; t < f.term_count; ++t) {
+							const ShellTerm& term = f_terms[t];
+							const double ty0 = ty[term.e_y * grid.dimensions.y + y], tz0 = tz[term.e_z * grid.dimensions.z + z];
+							a[term.e_x] += term.weight * ty0 * tz0;
+							if (!gradient) continue;
+
+							const double ty1 = ty[(term.e_y + 1) * grid.dimensions.y + y], tz1 = tz[(term.e_z + 1) * grid.dimensions.z + z];
+							const double dy = (term.e_y ? term.e_y * ty[(term.e_y - 1) * grid.dimensions.y + y] : 0.0) + a2 * ty1;
+							const double dz = (term.e_z ? term.e_z * tz[(term.e_z - 1) * grid.dimensions.z + z] : 0.0) + a2 * tz1;
+							if (term.e_x) ax[term.e_x - 1] += term.e_x * term.weight * ty0 * tz0;
+							ax[term.e_x + 1] += a2 * term.weight * ty0 * tz0;
+							ay[term.e_x] += term.weight * dy * tz0;
+							az[term.e_x] += term.weight * ty0 * dz;
+						}
+
+						const int offset = tile_width * (y + tile_size * z);
+						for (int k = 0; k < table_powers; ++k) {
+							const double* row = tx + k * table_width;
+							const double coefficients[4] = { a[k], ax[k], ay[k], az[k] };
+							for (int c = 0; c < (gradient ? 4 : 1); ++c) {
+								if (coefficients[c] == 0.0) continue;
+								const T w = (T)(f_primitives[p].y * coefficients[c]);
+								T* out = (c ? gradient + (c - 1) * tile_voxels : psi) + offset;
+								for (int x = 0; x < tile_width; ++x) out[x] += w * (T)row[x];
+							}
+						}
+					}
+				}
+				table += stride;
+			}
+			return;
+		}
+
+		const int point_powers = powers + (gradient ? 1 : 0);
+		const glm::dvec3 r0 = grid.position(min) - f.origin;
+		for (int z = 0; z < extent.z; ++z) {
+			const T rz = (T)(r0.z + grid.spacing.z * z);
+			for (int k = 1; k <= point_powers; ++k) pz[k] = pz[k - 1] * rz;
+
+			for (int y = 0; y < extent.y; ++y) {
+				const T ry = (T)(r0.y + grid.spacing.y * y);
+				for (int k = 1; k <= point_powers; ++k) py[k] = py[k - 1] * ry;
+				const T yz2 = ry * ry + rz * rz;
+
+				const int offset = tile_width * (y + tile_size * z);
+				T* out = psi + offset;
+				for (int c = 0; c < chunks; ++c) {
+					for (int i = 0; i < N; ++i) {
+						dx[i] = (T)(r0.x + grid.spacing.x * (c * N + i));
+						r2[i] = dx[i] * dx[i] + yz2;
+					}
+					for (int k = 1; k <= point_powers; ++k) {
+						for (int i = 0; i < N; ++i) px[k][i] = px[k - 1][i] * dx[i];
+					}
+
+					if (f.first_group < 0) {
+						for (int i = 0; i < N; ++i) R[i] = Q[i] = S[i] = (T)0.0;
+						for (uint p = 0; p < f.primitive_count; ++p) {
+							const T a = (T)-f_primitives[p].x;
+							const T w = (T)f_primitives[p].y;
+							for (int i = 0; i < N; ++i) arg[i] = a * r2[i];
+							flo::exp<T, N, Bytes>(arg, e);
+							for (int i = 0; i < N; ++i) R[i] += w * e[i];
+							if (gradient) {
+								for (int i = 0; i < N; ++i) S[i] += a * w * e[i];
+							}
+						}
+						for (uint t = 0; t < f.term_count; ++t) {
+							const T w = (T)f_terms[t].weight * py[f_terms[t].e_y] * pz[f_terms[t].e_z];
+							for (int i = 0; i < N; ++i) Q[i] += w * px[f_terms[t].e_x][i];
+						}
+						for (int i = 0; i < N; ++i) out[c * N + i] += R[i] * Q[i];
+						if (!gradient) continue;
+
+						// grad (R Q) = Q grad R + R grad Q, where grad R = 2 S r.
+						for (int i = 0; i < N; ++i) Qx[i] = Qy[i] = Qz[i] = (T)0.0;
+						for (uint t = 0; t < f.term_count; ++t) {
+							const ShellTerm& term = f_terms[t];
+							const T w = (T)term.weight;
+							if (term.e_x) {
+								const T wx = w * (T)term.e_x * py[term.e_y] * pz[term.e_z];
+								for (int i = 0; i < N; ++i) Qx[i] += wx * px[term.e_x - 1][i];
+							}
+							if (term.e_y) {
+								const T wy = w * (T)term.e_y * py[term.e_y - 1] * pz[term.e_z];
+								for (int i = 0; i < N; ++i) Qy[i] += wy * px[term.e_x][i];
+							}
+							if (term.e_z) {
+								const T wz = w * (T)term.e_z * py[term.e_y] * pz[term.e_z - 1];
+								for (int i = 0; i < N; ++i) Qz[i] += wz * px[term.e_x][i];
+							}
+						}
+						T* out_x = gradient + offset + c * N;
+						T* out_y = out_x + tile_voxels;
+						T* out_z = out_y + tile_voxels;
+						for (int i = 0; i < N; ++i) {
+							const T s = (T)2.0 * S[i] * Q[i];
+							out_x[i] += s * dx[i] + R[i] * Qx[i];
+							out_y[i] += s * ry + R[i] * Qy[i];
+							out_z[i] += s * rz + R[i] * Qz[i];
+						}
+						continue;
+					}
+
+					// Slater type extents share R between all radial tables of the center.
+					for (int i = 0; i < N; ++i) {
+						R[i] = std::sqrt(r2[i]);
+						phi[i] = gx[i] = gy[i] = gz[i] = (T)0.0;
+					}
+					for (uint g = 0; g < f.group_count; ++g) {
+						const SlaterGroup& group = slater_groups[f.first_group + g];
+						const ShellTerm* g_terms = terms.data() + group.first_term;
+						radial_tables[group.table].lookup<T, N>(R, e, gradient ? S : nullptr);
+						for (int i = 0; i < N; ++i) Q[i] = (T)0.0;
+						for (uint t = 0; t < group.term_count; ++t) {
+							const T w = (T)g_terms[t].weight * py[g_terms[t].e_y] * pz[g_terms[t].e_z];
+							for (int i = 0; i < N; ++i) Q[i] += w * px[g_terms[t].e_x][i];
+						}
+						for (int i = 0; i < N; ++i) phi[i] += e[i] * Q[i];
+						if (!gradient) continue;
+
+						// grad (g Q) = Q g' r / R + g grad Q
+						for (int i = 0; i < N; ++i) Qx[i] = Qy[i] = Qz[i] = (T)0.0;
+						for (uint t = 0; t < group.term_count; ++t) {
+							const ShellTerm& term = g_terms[t];
+							const T w = (T)term.weight;
+							if (term.e_x) {
+								const T wx = w * (T)term.e_x * py[term.e_y] * pz[term.e_z];
+								for (int i = 0; i < N; ++i) Qx[i] += wx * px[term.e_x - 1][i];
+							}
+							if (term.e_y) {
+								const T wy = w * (T)term.e_y * py[term.e_y - 1] * pz[term.e_z];
+								for (int i = 0; i < N; ++i) Qy[i] += wy * px[term.e_x][i];
+							}
+							if (term.e_z) {
+								const T wz = w * (T)term.e_z * py[term.e_y] * pz[term.e_z - 1];
+								for (int i = 0; i < N; ++i) Qz[i] += wz * px[term.e_x][i];
+							}
+						}
+						for (int i = 0; i < N; ++i) {
+							const T radial = R[i] > (T)0.0 ? S[i] * Q[i] / R[i] : (T)0.0;
+							gx[i] += radial * dx[i] + e[i] * Qx[i];
+							gy[i] += radial * ry + e[i] * Qy[i];
+							gz[i] += radial * rz + e[i] * Qz[i];
+						}
+					}
+
+					for (int i = 0; i < N; ++i) out[c * N + i] += phi[i];
+					if (!gradient) continue;
+
+					T* out_x = gradient + offset + c * N;
+					for (int i = 0; i < N; ++i) {
+						out_x[i] += gx[i];
+						out_x[i + tile_voxels] += gy[i];
+						out_x[i + 2 * tile_voxels] += gz[i];
+					}
+				}
+			}
+		}
+	}
+
+	template<typename T>
+	void GridEvaluator::accumulateAVX2(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const {
+		accumulateLanes<T, 32>(min, max, index, psi, gradient);
+	}
+
+	template<typename T>
+	void GridEvaluator::accumulateAVX512(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const {
+		accumulateLanes<T, 64>(min, max, index, psi, gradient);
+	}
+
+	template<typename T>
+	void GridEvaluator::accumulate(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const {
+		switch (flo::simdRegisterBytes()) {
+		case 64: accumulateAVX512(min, max, index, psi, gradient); break;
+		case 32: accumulateAVX2(min, max, index, psi, gradient); break;
+		default: accumulateLanes<T, flo::simd_register_bytes>(min, max, index, psi, gradient);
+		}
+	}
+
+	template void GridEvaluator::accumulate<float>(const glm::ivec3& min, const glm::ivec3& max, uint index, float* psi, float* gradient) const;
+	template void GridEvaluator::accumulate<double>(const glm::ivec3& min, const glm::ivec3& max, uint index, double* psi, double* gradient) const;
+
+	template<typename T>
+	void GridEvaluator::evaluateFunctions(const glm::ivec3& min, const glm::ivec3& max, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<T>& values) const {
+		alignas(64) T psi[tile_voxels];
+		std::vector<T> gradient(gradients ? 3 * tile_voxels : 0);
+		for (uint i = 0; i < list.size();) {
+			const int function = functions[list[i]].function;
+			for (int v = 0; v < tile_voxels; ++v) psi[v] = (T)0.0;
+			std::fill(gradient.begin(), gradient.end(), (T)0.0);
+			for (; i < list.size() && functions[list[i]].function == function; ++i) accumulate(min, max, list[i], psi, gradients ? gradient.data() : nullptr);
+
+			indices.push_back(function);
+			values.insert(values.end(), psi, psi + tile_voxels);
+			values.insert(values.end(), gradient.begin(), gradient.end());
+		}
+	}
+
+	template void GridEvaluator::evaluateFunctions<float>(const glm::ivec3& min, const glm::ivec3& max, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<float>& values) const;
+	template void GridEvaluator::evaluateFunctions<double>(const glm::ivec3& min, const glm::ivec3& max, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<double>& values) const;
+
+	template<typename T, uint Bytes>
+	FLO_INLINE void GridEvaluator::accumulatePointLanes(const glm::dvec3* points, uint index, T* psi, T* gradient) const {
+		constexpr int N = flo::lane_count<T, Bytes>;
+		constexpr int max_power = 10;
+		static_assert(tile_voxels % N == 0, "Points must split evenly into SIMD lanes.");
+
+		// Every lane has a point of its own, so all three axes need powers per lane.
+		alignas(64) T r2[N], R[N], Q[N], p[3][max_power + 1][N], phi[N], arg[N], e[N];
+		alignas(64) T S[N], Qx[N], Qy[N], Qz[N], gx[N], gy[N], gz[N];
+		for (int a = 0; a < 3; ++a) {
+			for (int i = 0; i < N; ++i) p[a][0][i] = (T)1.0;
+		}
+		T (&px)[max_power + 1][N] = p[0];
+		T (&py)[max_power + 1][N] = p[1];
+		T (&pz)[max_power + 1][N] = p[2];
+
+		const BasisExtent& f = functions[index];
+		const int powers = glm::min(f.max_exponent, max_power - 1) + (gradient ? 1 : 0);
+		const ShellTerm* f_terms = terms.data() + f.first_term;
+		const glm::dvec2* f_primitives = primitives.data() + f.first_primitive;
+
+		for (int c = 0; c < tile_voxels; c += N) {
+			for (int i = 0; i < N; ++i) {
+				const glm::dvec3 r = points[c + i] - f.origin;
+				for (int a = 0; a < 3; ++a) p[a][1][i] = (T)r[a];
+				r2[i] = px[1][i] * px[1][i] + py[1][i] * py[1][i] + pz[1][i] * pz[1][i];
+			}
+			for (int a = 0; a < 3; ++a) {
+				for (int k = 2; k <= powers; ++k) {
+					for (int i = 0; i < N; ++i) p[a][k][i] = p[a][k - 1][i] * p[a][1][i];
+				}
+			}
+
+			if (f.first_group < 0) {
+				for (int i = 0; i < N; ++i) R[i] = Q[i] = S[i] = (T)0.0;
+				for (uint q = 0; q < f.primitive_count; ++q) {
+					const T a = (T)-f_primitives[q].x;
+					const T w = (T)f_primitives[q].y;
+					for (int i = 0; i < N; ++i) arg[i] = a * r2[i];
+					flo::exp<T, N, Bytes>(arg, e);
+					for (int i = 0; i < N; ++i) R[i] += w * e[i];
+					if (gradient) {
+						for (int i = 0; i < N; ++i) S[i] += a * w * e[i];
+					}
+				}
+				for (uint t = 0; t < f.term_count; ++t) {
+					const ShellTerm& term = f_terms[t];
+					const T w = (T)term.weight;
+					for (int i = 0; i < N; ++i) Q[i] += w * px[term.e_x][i] * py[term.e_y][i] * pz[term.e_z][i];
+				}
+				for (int i = 0; i < N; ++i) psi[c + i] += R[i] * Q[i];
+				if (!gradient) continue;
+
+				// grad (R Q) = Q grad R + R grad Q, where grad R = 2 S r.
+				for (int i = 0; i < N; ++i) Qx[i] = Qy[i] = Qz[i] = (T)0.0;
+				for (uint t = 0; t < f.term_count; ++t) {
+					const ShellTerm& term = f_terms[t];
+					const T w = (T)term.weight;
+					for (int i = 0; i < N; ++i) {
+						if (term.e_x) Qx[i] += w * (T)term.e_x * px[term.e_x - 1][i] * py[term.e_y][i] * pz[term.e_z][i];
+						if (term.e_y) Qy[i] += w * (T)term.e_y * px[term.e_x][i] * py[term.e_y - 1][i] * pz[term.e_z][i];
+						if (term.e_z) Qz[i] += w * (T)term.e_z * px[term.e_x][i] * py[term.e_y][i] * pz[term.e_z - 1][i];
+					}
+				}
+				for (int i = 0; i < N; ++i) {
+					const T s = (T)2.0 * S[i] * Q[i];
+					gradient[c + i] += s * px[1][i] + R[i] * Qx[i];
+					gradient[c + i + tile_voxels] += s * py[1][i] + R[i] * Qy[i];
+					gradient[c + i + 2 * tile_voxels] += s * pz[1][i] + R[i] * Qz[i];
+				}
+				continue;
+			}
+
+			for (int i = 0; i < N; ++i) {
+				R[i] = std::sqrt(r2[i]);
+				phi[i] = gx[i] = gy[i] = gz[i] = (T)0.0;
+			}
+			for (uint g = 0; g < f.group_count; ++g) {
+				const SlaterGroup& group = slater_groups[f.first_group + g];
+				const ShellTerm* g_terms = terms.data() + group.first_term;
+				radial_tables[group.table].lookup<T, N>(R, e, gradient ? S : nullptr);
+				for (int i = 0; i < N; ++i) Q[i] = (T)0.0;
+				for (uint t = 0; t < group.term_count; ++t) {
+					const ShellTerm& term = g_terms[t];
+					const T w = (T)term.weight;
+					for (int i = 0; i < N; ++i) Q[i] += w * px[term.e_x][i] * py[term.e_y][i] * pz[term.e_z][i];
+				}
+				for (int i = 0; i < N; ++i) phi[i] += e[i] * Q[i];
+				if (!gradient) continue;
+
+				// grad (g Q) = Q g' r / R + g grad Q
+				for (int i = 0; i < N; ++i) Qx[i] = Qy[i] = Qz[i] = (T)0.0;
+				for (uint t = 0; t < group.term_count; ++t) {
+					const ShellTerm& term = g_terms[t];
+					const T w = (T)term.weight;
+					for (int i = 0; i < N; ++i) {
+						if (term.e_x) Qx[i] += w * (T)term.e_x * px[term.e_x - 1][i] * py[term.e_y][i] * pz[term.e_z][i];
+						if (term.e_y) Qy[i] += w * (T)term.e_y * px[term.e_x][i] * py[term.e_y - 1][i] * pz[term.e_z][i];
+						if (term.e_z) Qz[i] += w * (T)term.e_z * px[term.e_x][i] * py[term.e_y][i] * pz[term.e_z - 1][i];
+					}
+				}
+				for (int i = 0; i < N; ++i) {
+					const T radial = R[i] > (T)0.0 ? S[i] * Q[i] / R[i] : (T)0.0;
+					gx[i] += radial * px[1][i] + e[i] * Qx[i];
+					gy[i] += radial * py[1][i] + e[i] * Qy[i];
+					gz[i] += radial * pz[1][i] + e[i] * Qz[i];
+				}
+			}
+
+			for (int i = 0; i < N; ++i) psi[c + i] += phi[i];
+			if (!gradient) continue;
+
+			for (int i = 0; i < N; ++i) {
+				gradient[c + i] += gx[i];
+				gradient[c + i + tile_voxels] += gy[i];
+				gradient[c + i + 2 * tile_voxels] += gz[i];
+			}
+		}
+	}
+
+	template<typename T>
+	void GridEvaluator::accumulatePointsAVX2(const glm::dvec3* points, uint index, T* psi, T* gradient) const {
+		accumulatePointLanes<T, 32>(points, index, psi, gradient);
+	}
+
+	template<typename T>
+	void GridEvaluator::accumulatePointsAVX512(const glm::dvec3* points, uint index, T* psi, T* gradient) const {
+		accumulatePointLanes<T, 64>(points, index, psi, gradient);
+	}
+
+	template<typename T>
+	void GridEvaluator::accumulatePoints(const glm::dvec3* points, uint index, T* psi, T* gradient) const {
+		switch (flo::simdRegisterBytes()) {
+		case 64: accumulatePointsAVX512(points, index, psi, gradient); break;
+		case 32: accumulatePointsAVX2(points, index, psi, gradient); break;
+		default: accumulatePointLanes<T, flo::simd_register_bytes>(points, index, psi, gradient);
+		}
+	}
+
+	template<typename T>
+	void GridEvaluator::evaluatePointFunctions(const glm::dvec3* points, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<T>& values) const {
+		alignas(64) T psi[tile_voxels];
+		std::vector<T> gradient(gradients ? 3 * tile_voxels : 0);
+		for (uint i = 0; i < list.size();) {
+			const int function = functions[list[i]].function;
+			for (int v = 0; v < tile_voxels; ++v) psi[v] = (T)0.0;
+			std::fill(gradient.begin(), gradient.end(), (T)0.0);
+			for (; i < list.size() && functions[list[i]].function == function; ++i) accumulatePoints(points, list[i], psi, gradients ? gradient.data() : nullptr);
+
+			indices.push_back(function);
+			values.insert(values.end(), psi, psi + tile_voxels);
+			values.insert(values.end(), gradient.begin(), gradient.end());
+		}
+	}
+
+	template void GridEvaluator::evaluatePointFunctions<float>(const glm::dvec3* points, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<float>& values) const;
+	template void GridEvaluator::evaluatePointFunctions<double>(const glm::dvec3* points, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<double>& values) const;
+
+	template<typename T>
+	void GridEvaluator::evaluateTileLanes(uint tile, const std::vector<uint>& list, BrickMap& bricks) const {
+		alignas(64) T psi[tile_voxels];
+		const glm::ivec3 min = grid.tileMin(tile);
+		const glm::ivec3 max = grid.tileMax(tile);
+		for (int i = 0; i < tile_voxels; ++i) psi[i] = (T)0.0;
+		std::vector<T> gradient(gradients ? 3 * tile_voxels : 0, (T)0.0);
+
+		for (uint index : list) accumulate(min, max, index, psi, gradients ? gradient.data() : nullptr);
+
+		if constexpr (std::is_same_v<T, float>) bricks.writeTile(tile, psi, gradients ? gradient.data() : nullptr);
+		else {
+			alignas(64) float values[tile_voxels];
+			for (int i = 0; i < tile_voxels; ++i) values[i] = (float)psi[i];
+			std::vector<float> gradient_values(gradient.begin(), gradient.end());
+			bricks.writeTile(tile, values, gradients ? gradient_values.data() : nullptr);
+		}
+	}
+
+	void GridEvaluator::evaluateTile(uint tile, const std::vector<uint>& list, BrickMap& bricks) const {
+		// Nothing overlaps the tile, its brick stays empty.
+		if (list.empty()) bricks.release(tile);
+		else if (single_precision) evaluateTileLanes<float>(tile, list, bricks);
+		else evaluateTileLanes<double>(tile, list, bricks);
+	}
+}
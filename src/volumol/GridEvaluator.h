@@ -0,0 +1,209 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <atomic>
+
+#include "Orbital.h"
+#include "../logic/SIMD.h"
+#include "../logic/ThreadPool.h"
+
+namespace mol {
+	// Settings that evaluation on the CPU depends on. Work that runs on after the call that started it, like the levels of a Refinement,
+	// keeps a copy, so that it does not race with changes of the global settings and every level is evaluated alike.
+	struct EvaluationSettings {
+		bool separable = false;
+		bool single_precision = false;
+		double tolerance = 0.0;
+	};
+
+	// The current values of the global settings.
+	EvaluationSettings evaluationSettings();
+
+	// Tiles of the grid are the bricks of a BrickMap, they share their numbering.
+	struct TileGrid {
+		glm::ivec3 dimensions = glm::ivec3(0);
+		glm::ivec3 tile_count = glm::ivec3(0);
+		glm::dvec3 origin = glm::dvec3(0.0);
+		glm::dvec3 spacing = glm::dvec3(0.0);
+
+		TileGrid() = default;
+
+		TileGrid(const CubeMap& map);
+
+		uint size() const;
+
+		glm::ivec3 tileMin(uint tile) const;
+
+		glm::ivec3 tileMax(uint tile) const;
+
+		glm::dvec3 position(const glm::ivec3& voxel) const;
+	};
+
+	// Radial part R^n exp(-a R) of Slater type orbitals and its derivative, tabulated for cubic Hermite interpolation.
+	// The spacing is halved until interpolation stays within radial_table_error of the largest value. Beyond the last node, the table reads as zero.
+	struct RadialTable {
+		double a = 0.0;
+		int n = 0;
+		double inverse_spacing = 0.0;
+		// Values and derivatives times the spacing at every node.
+		std::vector<double> values, slopes;
+
+		RadialTable(double a, int n);
+
+		double exact(double R) const;
+
+		// Interpolates value and derivative at R, in SIMD lanes.
+		template<typename T, int N>
+		void lookup(const T* R, T* value, T* derivative) const;
+	};
+
+	// One radial function of a Slater type extent and the polynomial terms that it multiplies.
+	struct SlaterGroup {
+		uint table = 0;
+		uint first_term = 0, term_count = 0;
+	};
+
+	// A unit of evaluation of an orbital. Gaussians are stored as a contracted radial part sum_i c_i exp(-a_i r^2)
+	// times a polynomial, whose terms already contain the LCAO coefficients. For shells, the polynomial sums up all components.
+	// Slater type orbitals are gathered by center: Primitives that share the radial part R^n exp(-a R) form a group, whose radial part is
+	// looked up from a table once per voxel and multiplies the polynomial of the group. The distance R is shared by all groups of the center.
+	struct BasisExtent {
+		glm::dvec3 origin = glm::dvec3(0.0);
+		double radius = 0.0;
+		int max_exponent = 0;
+
+		uint first_primitive = 0, primitive_count = 0;
+		uint first_term = 0, term_count = 0;
+
+		// Groups of a Slater type extent in GridEvaluator::slater_groups, -1 for Gaussians.
+		int first_group = -1;
+		uint group_count = 0;
+
+		// Offset of the per-axis tables of the primitives in GridEvaluator::axis_tables, -1 if the function is not separable.
+		int axis_table = -1;
+		// Index of the basis function, only set if the evaluator keeps basis functions apart.
+		int function = -1;
+	};
+
+	// One term c r^n exp(-a r^q) of a bound on the magnitude of a basis function, q is 2 for Gaussians and 1 for Slater type orbitals.
+	struct RadialBound {
+		double c = 0.0;
+		int n = 0;
+		double a = 0.0;
+		int q = 2;
+	};
+
+	// Evaluates linear combinations of basis functions grid-major: The cubemap is walked tile by tile,
+	// each tile gathers the basis functions whose extent overlaps it and every voxel is written exactly once.
+	// Basis functions of a shell share one evaluation of the radial part.
+	// If per_function is set, components of shells are not merged and every extent belongs to exactly one basis function.
+	// If separable is set, Gaussians are factored into exp(-a x^2) x^i * exp(-a y^2) y^j * exp(-a z^2) z^k, which are tabulated
+	// once per primitive along the x, y and z samples of the grid, so that voxels only cost a few multiply-adds per primitive.
+	struct GridEvaluator {
+		TileGrid grid;
+		std::vector<BasisExtent> functions;
+		std::vector<glm::dvec2> primitives;
+		std::vector<ShellTerm> terms;
+		std::vector<double> axis_tables;
+		std::vector<SlaterGroup> slater_groups;
+		std::vector<RadialTable> radial_tables;
+		bool single_precision = false;
+		// Taken from the map. Gradients are written to the other three channels, per-axis tables then hold one more power for the derivatives.
+		bool gradients = false;
+		// Extents that screening kept and dropped.
+		uint kept = 0, dropped = 0;
+
+		// If tolerance is above 0, the radius of every extent is chosen so that the error of the whole combination stays below it, see screen().
+		// weights holds the factor by which each basis function is scaled further on, like the density does, and requires per_function.
+		GridEvaluator(const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<double>& coefficients,
+			bool separable = false, bool per_function = false, double tolerance = 0.0, const std::vector<double>* weights = nullptr);
+
+		void listFunctions(const glm::ivec3& min, const glm::ivec3& max, std::vector<uint>& list) const;
+
+		// Lists the extents that overlap the box between box_min and box_max.
+		void listFunctions(const glm::dvec3& box_min, const glm::dvec3& box_max, std::vector<uint>& list) const;
+
+		// Writes a tile into the brick of the same index, list holds the extents that overlap it.
+		void evaluateTile(uint tile, const std::vector<uint>& list, BrickMap& bricks) const;
+
+		// Adds one extent to psi, which holds tile_width * tile_size * tile_size values of a tile.
+		// If gradient is given, the x, y and z derivatives are added to it as well, tile_voxels values each. This requires gradients.
+		template<typename T>
+		void accumulate(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient = nullptr) const;
+
+		// Appends the values of every basis function in list to values, tile_voxels at a time, and its index to indices.
+		// With gradients, the values of each function are followed by its x, y and z derivatives.
+		// Requires per_function, the extents of one basis function must be consecutive in list.
+		template<typename T>
+		void evaluateFunctions(const glm::ivec3& min, const glm::ivec3& max, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<T>& values) const;
+
+		// Like evaluateFunctions, but at tile_voxels arbitrary points instead of the voxels of a tile, so that the results fit everything that takes tiles.
+		// Requires an evaluator that is not separable, the grid is not used.
+		template<typename T>
+		void evaluatePointFunctions(const glm::dvec3* points, const std::vector<uint>& list, std::vector<uint>& indices, std::vector<T>& values) const;
+
+	private:
+		void addGaussian(BasisExtent& f, bool separable);
+
+		void tabulateAxes(BasisExtent& f);
+
+		// Adds the Slater type primitives of several basis functions on one center as one extent, scaled by their coefficients.
+		void addSlater(const glm::dvec3& origin, const std::vector<const ContractedBasis*>& basis, const std::vector<double>& coefficients, int function);
+
+		uint radialTable(double a, int n);
+
+		// Bound on the magnitude of an extent, including its coefficients.
+		std::vector<RadialBound> extentBound(const BasisExtent& f) const;
+
+		// Every extent may contribute at most tolerance / functions.size() outside of its radius. Extents that never exceed this are dropped.
+		void screen(double tolerance, const std::vector<double>* weights);
+
+		// Adds one extent at tile_voxels points, like accumulate() does for the voxels of a tile.
+		template<typename T>
+		void accumulatePoints(const glm::dvec3* points, uint index, T* psi, T* gradient) const;
+
+		// The kernels behind accumulate() and accumulatePoints(), in lanes that fill registers of Bytes bytes. They are always inlined into the
+		// variants below, which are compiled for AVX2 and AVX-512, the public functions call whichever the CPU supports.
+		template<typename T, uint Bytes>
+		void accumulateLanes(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const;
+
+		template<typename T>
+		FLO_TARGET_AVX2 void accumulateAVX2(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const;
+
+		template<typename T>
+		FLO_TARGET_AVX512 void accumulateAVX512(const glm::ivec3& min, const glm::ivec3& max, uint index, T* psi, T* gradient) const;
+
+		template<typename T, uint Bytes>
+		void accumulatePointLanes(const glm::dvec3* points, uint index, T* psi, T* gradient) const;
+
+		template<typename T>
+		FLO_TARGET_AVX2 void accumulatePointsAVX2(const glm::dvec3* points, uint index, T* psi, T* gradient) const;
+
+		template<typename T>
+		FLO_TARGET_AVX512 void accumulatePointsAVX512(const glm::dvec3* points, uint index, T* psi, T* gradient) const;
+
+		template<typename T>
+		void evaluateTileLanes(uint tile, const std::vector<uint>& list, BrickMap& bricks) const;
+	};
+
+	double basisRadius(const ContractedBasis& basis);
+
+	// Largest value of the sum of the terms over all distances, bounded by the sum of the largest values of the terms.
+	double boundPeak(const std::vector<RadialBound>& terms);
+
+	// Distance beyond which the sum of the terms stays below limit, 0 if it never exceeds limit.
+	double screeningRadius(const std::vector<RadialBound>& terms, double limit);
+
+	// Bound on the magnitude of a basis function with unit coefficient.
+	std::vector<RadialBound> basisBound(const ContractedBasis& basis);
+
+	// Calls f(tile) for every tile index on the threads of the global pool, one task per tile. Once cancel is set, the remaining tiles are skipped.
+	template<typename F>
+	void forEachTile(uint tile_count, const F& f, const std::atomic<bool>* cancel = nullptr) {
+		flo::ThreadPool::global().parallelFor(tile_count, [&f, cancel](uint tile) {
+			if (cancel && *cancel) return;
+			flo::FlushDenormals flush;
+			f(tile);
+		});
+	}
+}
@@ -1,10 +1,157 @@
 #include "Isosurface.h"
 
 #include "../logic/ConsoleUtils.h"
+#include "../logic/ThreadPool.h"
+
+#include <thread>
+#include <atomic>
 
 namespace mol {
 	extern const char tri_table[256][16];
 
+	// A corner of a triangle, vertices on the same cube edge are merged once all layers are done.
+	struct IsoCorner {
+		uint edge;
+		glm::vec3 position;
+		glm::vec3 normal;
+	};
+
+	// Gradient at a voxel for the normals, analytic if the map holds one and from central differences otherwise.
+	glm::vec3 cornerGradient(CubeMap& cubemap, const glm::ivec3& voxel) {
+		if (cubemap.bricks.hasGradients()) return cubemap.bricks.gradient(voxel);
+		return cubemap.sampleGradient(voxel);
+	}
+
+	void polygonizeLayer(CubeMap& cubemap, float isovalue, bool flip, uint z, std::vector<IsoCorner>& corners) {
+		const BrickMap& bricks = cubemap.bricks;
+		const uint width = cubemap.texture.width;
+		const uint height = cubemap.texture.height;
+		const uint depth = cubemap.texture.depth;
+
+		for (uint y = 0; y < height - 1; ++y) {
+			for (uint x = 0; x < width - 1; ++x) {
+				float values[8] = {
+					bricks.value(glm::ivec3(x    , y    , z    )), // 000
+					bricks.value(glm::ivec3(x + 1, y    , z    )), // 100
+					bricks.value(glm::ivec3(x + 1, y    , z + 1)), // 101
+					bricks.value(glm::ivec3(x    , y    , z + 1)), // 001
+					bricks.value(glm::ivec3(x    , y + 1, z    )), // 010
+					bricks.value(glm::ivec3(x + 1, y + 1, z    )), // 110
+					bricks.value(glm::ivec3(x + 1, y + 1, z + 1)), // 111
+					bricks.value(glm::ivec3(x    , y + 1, z + 1)), // 011
+				};
+
+				if (flip) {
+					values[0] *= -1.f;
+					values[1] *= -1.f;
+					values[2] *= -1.f;
+					values[3] *= -1.f;
+					values[4] *= -1.f;
+					values[5] *= -1.f;
+					values[6] *= -1.f;
+					values[7] *= -1.f;
+				}
+
+				unsigned int index = 0;
+				if (values[0] > isovalue) index |= 1;
+				if (values[1] > isovalue) index |= 2;
+				if (values[2] > isovalue) index |= 4;
+				if (values[3] > isovalue) index |= 8;
+				if (values[4] > isovalue) index |= 16;
+				if (values[5] > isovalue) index |= 32;
+				if (values[6] > isovalue) index |= 64;
+				if (values[7] > isovalue) index |= 128;
+
+				if (!index || index == 255) continue;
+
+				glm::vec3 voxel_positions[8] = {
+					glm::vec3(0.0, 0.0, 0.0), // 000
+					glm::vec3(1.0, 0.0, 0.0), // 100
+					glm::vec3(1.0, 0.0, 1.0), // 101
+					glm::vec3(0.0, 0.0, 1.0), // 001
+					glm::vec3(0.0, 1.0, 0.0), // 010
+					glm::vec3(1.0, 1.0, 0.0), // 110
+					glm::vec3(1.0, 1.0, 1.0), // 111
+					glm::vec3(0.0, 1.0, 1.0), // 011
+				};
+
+				glm::vec3 normals[8] = {
+					cornerGradient(cubemap, glm::ivec3(x  , y  , z  )),
+					cornerGradient(cubemap, glm::ivec3(x+1, y  , z  )),
+					cornerGradient(cubemap, glm::ivec3(x+1, y  , z+1)),
+					cornerGradient(cubemap, glm::ivec3(x  , y  , z+1)),
+					cornerGradient(cubemap, glm::ivec3(x  , y+1, z  )),
+					cornerGradient(cubemap, glm::ivec3(x+1, y+1, z  )),
+					cornerGradient(cubemap, glm::ivec3(x+1, y+1, z+1)),
+					cornerGradient(cubemap, glm::ivec3(x  , y+1, z+1)),
+				};
+
+				glm::vec3 vertices[12] = {
+					voxel_positions[0] + (float)(isovalue - values[0]) * (voxel_positions[1] - voxel_positions[0]) / (float)(values[1] - values[0]),
+					voxel_positions[1] + (float)(isovalue - values[1]) * (voxel_positions[2] - voxel_positions[1]) / (float)(values[2] - values[1]),
+					voxel_positions[2] + (float)(isovalue - values[2]) * (voxel_positions[3] - voxel_positions[2]) / (float)(values[3] - values[2]),
+					voxel_positions[3] + (float)(isovalue - values[3]) * (voxel_positions[0] - voxel_positions[3]) / (float)(values[0] - values[3]),
+
+					voxel_positions[4] + (float)(isovalue - values[4]) * (voxel_positions[5] - voxel_positions[4]) / (float)(values[5] - values[4]),
+					voxel_positions[5] + (float)(isovalue - values[5]) * (voxel_positions[6] - voxel_positions[5]) / (float)(values[6] - values[5]),
+					voxel_positions[6] + (float)(isovalue - values[6]) * (voxel_positions[7] - voxel_positions[6]) / (float)(values[7] - values[6]),
+					voxel_positions[7] + (float)(isovalue - values[7]) * (voxel_positions[4] - voxel_positions[7]) / (float)(values[4] - values[7]),
+
+					voxel_positions[0] + (float)(isovalue - values[0]) * (voxel_positions[4] - voxel_positions[0]) / (float)(values[4] - values[0]),
+					voxel_positions[1] + (float)(isovalue - values[1]) * (voxel_positions[5] - voxel_positions[1]) / (float)(values[5] - values[1]),
+					voxel_positions[2] + (float)(isovalue - values[2]) * (voxel_positions[6] - voxel_positions[2]) / (float)(values[6] - values[2]),
+					voxel_positions[3] + (float)(isovalue - values[3]) * (voxel_positions[7] - voxel_positions[3]) / (float)(values[7] - values[3]),
+				};
+
+				uint buffer_indices[12] = {
+					(x +     (y + (z)    *height) * width) + 0 * width * height * depth,
+					(x + 1 + (y + (z)    *height) * width) + 2 * width * height * depth,
+					(x +     (y + (z + 1)*height) * width) + 0 * width * height * depth,
+					(x +     (y + (z)    *height) * width) + 2 * width * height * depth,
+
+					(x +     (y + 1 + (z)    *height) * width) + 0 * width * height * depth,
+					(x + 1 + (y + 1 + (z)    *height) * width) + 2 * width * height * depth,
+					(x +     (y + 1 + (z + 1)*height) * width) + 0 * width * height * depth,
+					(x +     (y + 1 + (z)    *height) * width) + 2 * width * height * depth,
+
+					(x     + (y + (z)    *height) * width) + 1 * width * height * depth,
+					(x + 1 + (y + (z)    *height) * width) + 1 * width * height * depth,
+					(x + 1 + (y + (z + 1)*height) * width) + 1 * width * height * depth,
+					(x     + (y + (z + 1)*height) * width) + 1 * width * height * depth,
+				};
+
+				const char* table = tri_table[index];
+
+				for (int i = 0; i < 15; ++i) {
+					if (table[i] == -1) break;
+
+					const glm::vec3 pos(x, y, z);
+
+					const char tri = table[i];
+
+					glm::vec3 vert = vertices[tri];
+					glm::vec3 p = pos + vertices[tri] + glm::vec3(0.5);
+					p *= glm::vec3(cubemap.size) / glm::vec3(width, height, depth);
+					p += cubemap.origin;
+					p = glm::mat3(cubemap.axes) * p;
+					glm::vec3 normal = glm::normalize(glm::mix(
+						glm::mix(
+							glm::mix(normals[0], normals[1], vert.x),
+							glm::mix(normals[4], normals[5], vert.x),
+							vert.y),
+						glm::mix(
+							glm::mix(normals[3], normals[2], vert.x),
+							glm::mix(normals[7], normals[6], vert.x),
+							vert.y),
+						vert.z));
+					if (!flip) normal *= -1.f;
+					normal = glm::mat3(cubemap.axes) * normal;
+					corners.push_back(IsoCorner{ buffer_indices[tri], p, normal });
+				}
+			}
+		}
+	}
+
 	fgr::Mesh generateIsosurface(CubeMap& cubemap, float isovalue, const glm::vec3& color, const glm::vec2& material_params, bool flip) {
 		fgr::TextureHandle3D& texture = cubemap.texture;
 		const uint width = texture.width;
@@ -15,141 +162,39 @@ namespace mol {
 
 		if (!width || !height || !depth) return mesh;
 
-		flo::Array<int> index_buffer(3 * width * height * depth);
-		for (int i = 0; i < 3 * width * height * depth; ++i) index_buffer[i] = -1;
+		// Values written on the GPU are only fetched now.
+		cubemap.download();
 
 		std::cout << "Rendering MO isosurface\nProgress:\n";
 
-		for (uint z = 0; z < depth - 1; ++z) {
-			if (z % (depth / 40) == 0) flo::printProgress((float)z / (float)(depth - 1));
-			for (uint y = 0; y < height - 1; ++y) {
-				for (uint x = 0; x < width - 1; ++x) {
-					float values[8] = {
-						texture.data[4 * (x +     (y +     (z    ) * height) * width)], // 000
-						texture.data[4 * (x + 1 + (y +     (z    ) * height) * width)], // 100
-						texture.data[4 * (x + 1 + (y +     (z + 1) * height) * width)], // 101
-						texture.data[4 * (x +     (y +     (z + 1) * height) * width)], // 001
-						texture.data[4 * (x +     (y + 1 + (z    ) * height) * width)], // 010
-						texture.data[4 * (x + 1 + (y + 1 + (z    ) * height) * width)], // 110
-						texture.data[4 * (x + 1 + (y + 1 + (z + 1) * height) * width)], // 111
-						texture.data[4 * (x +     (y + 1 + (z + 1) * height) * width)], // 011
-					};
-
-					if (flip) {
-						values[0] *= -1.f;
-						values[1] *= -1.f;
-						values[2] *= -1.f;
-						values[3] *= -1.f;
-						values[4] *= -1.f;
-						values[5] *= -1.f;
-						values[6] *= -1.f;
-						values[7] *= -1.f;
-					}
-
-					unsigned int index = 0;
-					if (values[0] > isovalue) index |= 1;
-					if (values[1] > isovalue) index |= 2;
-					if (values[2] > isovalue) index |= 4;
-					if (values[3] > isovalue) index |= 8;
-					if (values[4] > isovalue) index |= 16;
-					if (values[5] > isovalue) index |= 32;
-					if (values[6] > isovalue) index |= 64;
-					if (values[7] > isovalue) index |= 128;
-
-					if (!index || index == 255) continue;
-
-					glm::vec3 voxel_positions[8] = {
-						glm::vec3(0.0, 0.0, 0.0), // 000
-						glm::vec3(1.0, 0.0, 0.0), // 100
-						glm::vec3(1.0, 0.0, 1.0), // 101
-						glm::vec3(0.0, 0.0, 1.0), // 001
-						glm::vec3(0.0, 1.0, 0.0), // 010
-						glm::vec3(1.0, 1.0, 0.0), // 110
-						glm::vec3(1.0, 1.0, 1.0), // 111
-						glm::vec3(0.0, 1.0, 1.0), // 011
-					};
-
-					glm::vec3 normals[8] = {
-						cubemap.sampleGradient(glm::ivec3(x  , y  , z  )),
-						cubemap.sampleGradient(glm::ivec3(x+1, y  , z  )),
-						cubemap.sampleGradient(glm::ivec3(x+1, y  , z+1)),
-						cubemap.sampleGradient(glm::ivec3(x  , y  , z+1)),
-						cubemap.sampleGradient(glm::ivec3(x  , y+1, z  )),
-						cubemap.sampleGradient(glm::ivec3(x+1, y+1, z  )),
-						cubemap.sampleGradient(glm::ivec3(x+1, y+1, z+1)),
-						cubemap.sampleGradient(glm::ivec3(x  , y+1, z+1)),
-					};
-
-					glm::vec3 vertices[12] = {
-						voxel_positions[0] + (float)(isovalue - values[0]) * (voxel_positions[1] - voxel_positions[0]) / (float)(values[1] - values[0]),
-						voxel_positions[1] + (float)(isovalue - values[1]) * (voxel_positions[2] - voxel_positions[1]) / (float)(values[2] - values[1]),
-						voxel_positions[2] + (float)(isovalue - values[2]) * (voxel_positions[3] - voxel_positions[2]) / (float)(values[3] - values[2]),
-						voxel_positions[3] + (float)(isovalue - values[3]) * (voxel_positions[0] - voxel_positions[3]) / (float)(values[0] - values[3]),
-
-						voxel_positions[4] + (float)(isovalue - values[4]) * (voxel_positions[5] - voxel_positions[4]) / (float)(values[5] - values[4]),
-						voxel_positions[5] + (float)(isovalue - values[5]) * (voxel_positions[6] - voxel_positions[5]) / (float)(values[6] - values[5]),
-						voxel_positions[6] + (float)(isovalue - values[6]) * (voxel_positions[7] - voxel_positions[6]) / (float)(values[7] - values[6]),
-						voxel_positions[7] + (float)(isovalue - values[7]) * (voxel_positions[4] - voxel_positions[7]) / (float)(values[4] - values[7]),
-
-						voxel_positions[0] + (float)(isovalue - values[0]) * (voxel_positions[4] - voxel_positions[0]) / (float)(values[4] - values[0]),
-						voxel_positions[1] + (float)(isovalue - values[1]) * (voxel_positions[5] - voxel_positions[1]) / (float)(values[5] - values[1]),
-						voxel_positions[2] + (float)(isovalue - values[2]) * (voxel_positions[6] - voxel_positions[2]) / (float)(values[6] - values[2]),
-						voxel_positions[3] + (float)(isovalue - values[3]) * (voxel_positions[7] - voxel_positions[3]) / (float)(values[7] - values[3]),
-					};
-
-					uint buffer_indices[12] = {
-						(x +     (y + (z)    *height) * width) + 0 * width * height * depth,
-						(x + 1 + (y + (z)    *height) * width) + 2 * width * height * depth,
-						(x +     (y + (z + 1)*height) * width) + 0 * width * height * depth,
-						(x +     (y + (z)    *height) * width) + 2 * width * height * depth,
-
-						(x +     (y + 1 + (z)    *height) * width) + 0 * width * height * depth,
-						(x + 1 + (y + 1 + (z)    *height) * width) + 2 * width * height * depth,
-						(x +     (y + 1 + (z + 1)*height) * width) + 0 * width * height * depth,
-						(x +     (y + 1 + (z)    *height) * width) + 2 * width * height * depth,
-
-						(x     + (y + (z)    *height) * width) + 1 * width * height * depth,
-						(x + 1 + (y + (z)    *height) * width) + 1 * width * height * depth,
-						(x + 1 + (y + (z + 1)*height) * width) + 1 * width * height * depth,
-						(x     + (y + (z + 1)*height) * width) + 1 * width * height * depth,
-					};
-
-					const char* table = tri_table[index];
-
-					for (int i = 0; i < 15; ++i) {
-						if (table[i] == -1) break;
-
-						const glm::vec3 pos(x, y, z);
-
-						const char tri = table[i];
-
-						const int buffered_index = index_buffer[buffer_indices[tri]];
-						if (buffered_index < 0) {
-							index_buffer[buffer_indices[tri]] = mesh.vertices.size();
-							mesh.indices.push_back(mesh.vertices.size());
-							glm::vec3 vert = vertices[tri];
-							glm::vec3 p = pos + vertices[tri] + glm::vec3(0.5);
-							p *= glm::vec3(cubemap.size) / glm::vec3(width, height, depth);
-							p += cubemap.origin;
-							glm::vec3 normal = glm::normalize(glm::mix(
-								glm::mix(
-									glm::mix(normals[0], normals[1], vert.x),
-									glm::mix(normals[4], normals[5], vert.x),
-									vert.y),
-								glm::mix(
-									glm::mix(normals[3], normals[2], vert.x),
-									glm::mix(normals[7], normals[6], vert.x),
-									vert.y),
-								vert.z));
-							if (!flip) normal *= -1.f;
-							mesh.vertices.push_back(fgr::Vertex3D(p, color, material_params, normal));
-						}
-						else {
-							mesh.indices.push_back(buffered_index);
-						}
-					}
+		// Layers of cubes are polygonized in parallel, progress is only printed from the calling thread.
+		std::vector<std::vector<IsoCorner>> layers(depth - 1);
+		const std::thread::id caller = std::this_thread::get_id();
+		std::atomic<uint> finished = 0;
+		flo::ThreadPool::global().parallelFor(depth - 1, [&](uint z) {
+			polygonizeLayer(cubemap, isovalue, flip, z, layers[z]);
+
+			const uint done = ++finished;
+			if (done % glm::max(depth / 40, 1u) == 0 && std::this_thread::get_id() == caller) flo::printProgress((float)done / (float)(depth - 1));
+		});
+
+		// Merging in order of the layers gives the same mesh as a serial pass.
+		flo::Array<int> index_buffer(3 * width * height * depth);
+		for (int i = 0; i < 3 * width * height * depth; ++i) index_buffer[i] = -1;
+
+		for (std::vector<IsoCorner>& layer : layers) {
+			for (const IsoCorner& corner : layer) {
+				const int buffered_index = index_buffer[corner.edge];
+				if (buffered_index < 0) {
+					index_buffer[corner.edge] = mesh.vertices.size();
+					mesh.indices.push_back(mesh.vertices.size());
+					mesh.vertices.push_back(fgr::Vertex3D(corner.position, color, material_params, corner.normal));
+				}
+				else {
+					mesh.indices.push_back(buffered_index);
 				}
 			}
+			std::vector<IsoCorner>().swap(layer);
 		}
 
 		std::cout << '\n';
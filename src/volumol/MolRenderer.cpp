@@ -12,6 +12,7 @@
 #include "../graphics/Blur.h"
 #include "../graphics/Renderstate.h"
 #include "../logic/Random.h"
+#include "../logic/ThreadPool.h"
 
 namespace mol {
 	CubeMap cubemap;
@@ -35,6 +36,7 @@ namespace mol::Renderer {
 	bool update_molecule = false;
 
 	bool use_volumetric = false;
+	bool use_isosurface = false;
 
 	std::vector<glm::vec2> taa_jitter_offsets = {glm::vec2(0.f)};
 
@@ -128,6 +130,7 @@ namespace mol::Renderer {
 			"camera_dir",		// 23
 			"gradient_factor",	// 24
 			"offset",			// 25
+			"cubemap_axes",		// 26
 		});
 		volumetric_shader.compile("#define SHADOWMAP_LEVELS 1\n#define VOLUMETRIC_SHADOWMAP 1\n");
 
@@ -172,7 +175,11 @@ namespace mol::Renderer {
 
 		orientCamera(camera_position, camera_direction);
 
+		// Progressive cubemaps use the pool in the background.
+		if (_settings.thread_count != settings.thread_count) refreshCubeMap(true);
+
 		settings = _settings;
+		flo::ThreadPool::global().resize(settings.thread_count);
 		glm::vec3 sun_position = glm::mat3(model_matrix) * settings.sun_position;
 		mesh_shader.setVec3(3, glm::normalize(sun_position));
 		mesh_shader.setVec3(4, glm::pow(settings.sun_color, glm::vec3(2.2)));
@@ -227,6 +234,7 @@ namespace mol::Renderer {
 		}
 		setTransform(glm::mat4(1.0));
 		use_volumetric = false;
+		use_isosurface = false;
 		update_molecule = true;
 	}
 
@@ -277,6 +285,7 @@ namespace mol::Renderer {
 
 		volumetric_shader.setVec3(4, cubemap.origin);
 		volumetric_shader.setVec3(5, cubemap.size);
+		volumetric_shader.setMat3(26, glm::mat3(cubemap.axes));
 
 		use_volumetric = true;
 	}
@@ -288,12 +297,21 @@ namespace mol::Renderer {
 		isosurface_mesh.indices = iso_mesh.indices;
 		iso_mesh = generateIsosurface(cubemap, isovalue, settings.mo_colors[1], glm::vec2(settings.isosurface_roughness, settings.isosurface_metallicity), true);
 		isosurface_mesh.mergeMesh(iso_mesh, glm::mat4(1.0));
+		use_isosurface = true;
+	}
+
+	void refreshCubeMap(bool wait) {
+		if (refineCubeMap(wait) && use_isosurface) setIsosurface();
 	}
 
 	Atom getAtom(uint atom) {
 		return molecule.getAtom(atom);
 	}
 
+	const Molecule& getMolecule() {
+		return molecule;
+	}
+
 	void setTransform(const glm::mat4& transform) {
 		model_matrix = glm::inverse(transform);
 		updateSettings(settings);
@@ -341,6 +359,10 @@ namespace mol::Renderer {
 	}
 
 	void renderFrame(uint width, uint height) {
+		refreshCubeMap(false);
+		// A cubemap from the GPU is likely to be polygonized next, its values are copied back while frames are drawn.
+		if (use_isosurface) cubemap.prefetch();
+
 		if (update_molecule) {
 			molecule.generateMesh(molecule_mesh);
 			update_molecule = false;
@@ -498,6 +520,7 @@ namespace mol::Renderer {
 	void saveImage(const std::string& path, uint width, uint height) {
 		fgr::TextureHandle texture = fgr::TextureHandle(fgr::window::width, fgr::window::height);
 
+		refreshCubeMap(true);
 		renderFrame(width, height);
 
 		fgr::FrameBuffer fbo;
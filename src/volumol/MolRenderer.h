@@ -21,8 +21,13 @@ namespace mol::Renderer {
 
 	void setIsosurface();
 
+	// Shows levels of a progressive cubemap that have finished, see refineCubeMap().
+	void refreshCubeMap(bool wait);
+
 	Atom getAtom(uint atom);
 
+	const Molecule& getMolecule();
+
 	void setTransform(const glm::mat4& transform);
 
 	glm::mat4 getTransform(uint atom0, uint atom1, uint atom2, const glm::vec3 position0, const glm::vec3 dir01, const glm::vec3 dir02);
@@ -9,6 +9,7 @@
 
 namespace mol {
 	extern std::vector<ContractedBasis> basis_set;
+	extern std::vector<Shell> shells;
 	extern std::vector<MolecularOrbital> mos;
 }
 
@@ -117,6 +118,7 @@ namespace mol::Molden {
 			for (GTO& g : gtos) g.coeff *= contractions[i].y;
 			gto.gto_primitives.insert(gto.gto_primitives.end(), gtos.begin(), gtos.end());
 		}
+		shells[shells.size() - 1].components.push_back(sphericalShellTerms(l, m));
 	}
 
 	void addGTO(const std::vector<glm::dvec2>& contractions, int kx, int ky, int kz, glm::dvec3 position) {
@@ -127,9 +129,18 @@ namespace mol::Molden {
 		for (int i = 0; i < contractions.size(); ++i) {
 			gto.gto_primitives[i] = GTO(contractions[i].x, kx, ky, kz, contractions[i].y);
 		}
+		shells[shells.size() - 1].components.push_back(cartesianShellTerms(kx, ky, kz));
 	}
 
 	void addGTO(const std::vector<glm::dvec2>& contractions, int l, glm::dvec3 position) {
+		shells.push_back(Shell());
+		Shell& shell = shells[shells.size() - 1];
+		shell.origin = position;
+		shell.l = l;
+		shell.spherical = (l == 2 && spherical_d) || (l == 3 && spherical_f) || (l == 4 && spherical_g);
+		shell.first_function = basis_set.size();
+		for (const glm::dvec2& c : contractions) shell.primitives.push_back(glm::dvec2(c.x, c.y * radialNormalization(c.x, l)));
+
 		switch (l) {
 		case 0:
 			addGTO(contractions, 0, 0, 0, position);
@@ -222,6 +233,11 @@ namespace mol::Molden {
 		section = Section::search;
 		molecule.atoms.clear();
 		atom_positions.clear();
+		cancelRefinement();
+		basis_set.clear();
+		shells.clear();
+		mos.clear();
+		clearAOCache();
 
 		for (; !endOfFile(); nextLine()) {
 			handleFlag(getLine());
@@ -357,6 +373,7 @@ namespace mol::Molden {
 				MolecularOrbital& mo = mos[mos.size() - 1];
 				mo.lcao_coefficients = std::vector<double>(basis_set.size(), 0.0);
 				mo.basis = &basis_set;
+				mo.shells = &shells;
 				mo.use_stos = use_stos;
 
 				if (!findKeyword("Sym=")) {
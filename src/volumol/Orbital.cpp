@@ -2,13 +2,25 @@
 
 #include "../logic/MathUtil.h"
 #include "../logic/ConsoleUtils.h"
+#include "../logic/SIMD.h"
 #include "../graphics/FrameBuffer.h"
 #include "../graphics/Renderstate.h"
 #include "../graphics/ComputeShader.h"
+#include "../graphics/StorageBuffer.h"
+#include "../graphics/BufferTexture.h"
 #include "Molecule.h"
 #include "Settings.h"
+#include "GridEvaluator.h"
+#include "AOCache.h"
+#include "Density.h"
+#include "Refinement.h"
+#include "Symmetry.h"
 
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <algorithm>
 
 namespace mol {
 	glm::ivec3 Y_exponents[150] = {
@@ -108,14 +120,63 @@ namespace mol {
 	};
 
 	extern CubeMap cubemap;
+	extern Molecule molecule;
 
 	bool resize_cubemap = true;
 
 	std::vector<ContractedBasis> basis_set;
+	std::vector<Shell> shells;
+	AOCache ao_cache;
+	Refinement refinement;
 	std::vector<MolecularOrbital> mos;
 
+	// The grid and occupations of the last density that was written to the cubemap on the CPU.
+	struct DensityRecord {
+		bool valid = false;
+		glm::ivec3 dimensions = glm::ivec3(0);
+		glm::dvec3 origin = glm::dvec3(0.0);
+		glm::dvec3 size = glm::dvec3(0.0);
+		glm::dmat3 axes = glm::dmat3(1.0);
+		int channels = 0;
+		DensityChannel channel = DensityChannel::total;
+		// If set, the total and spin density are kept in density_total and density_spin, any channel can be composed from them.
+		bool spin_maps = false;
+		std::vector<double> occupations;
+	} density_record;
+	BrickMap density_total, density_spin;
+
+	// Copies of the basis set and shells in the frame of the principal axes of frame_source, see fitCubeFrame().
+	const std::vector<ContractedBasis>* frame_source = nullptr;
+	glm::dmat3 frame_axes = glm::dmat3(1.0);
+	std::vector<ContractedBasis> frame_basis;
+	std::vector<Shell> frame_shells;
+
 	fgr::Shader gto_shader, sto_shader, density_shader;
 	fgr::ComputeShader gto_compute, sto_compute, density_compute;
+	fgr::BufferTexture primitive_texture;
+
+#if USE_COMPUTE_SHADERS
+	// One primitive in the std430 layout of gto.comp, sto.comp and cull.comp. For STOs, exponents.w is the power of R.
+	struct GPUPrimitive {
+		glm::vec3 origin;
+		float alpha;
+		glm::ivec4 exponents;
+		float coeff;
+		int function;
+		int padding[2];
+	};
+	static_assert(sizeof(GPUPrimitive) == 48, "GPUPrimitive has to match the storage buffer layout of the shaders.");
+
+	// The primitives stay on the GPU until another basis is loaded, only the LCAO coefficients and culling radii are uploaded per orbital.
+	fgr::StorageBuffer primitive_buffer, coefficient_buffer, occupation_buffer, radius_buffer, value_buffer;
+	// Bins of bin_size^3 voxels list the primitives that reach them, bin_offsets holds where each list starts plus the total at the end.
+	fgr::StorageBuffer bin_offsets, bin_lists;
+	fgr::ComputeShader cull_compute;
+	constexpr int bin_size = 8;
+	const std::vector<ContractedBasis>* uploaded_basis = nullptr;
+	bool uploaded_stos = false;
+	std::vector<GPUPrimitive> uploaded_primitives;
+#endif
 
 	double pow(double x, int e) {
 		double r = 1.0;
@@ -219,6 +280,30 @@ namespace mol {
 		return std::vector<GTO>{};
 	}
 
+	double radialNormalization(double exponent, int l) {
+		return glm::pow(2.0 * exponent / PI, 0.75) * glm::sqrt(glm::pow(8.0 * exponent, l));
+	}
+
+	std::vector<ShellTerm> sphericalShellTerms(int l, int m) {
+		std::vector<GTO> gtos = generateSphericalGTO(1.0, l, m);
+		std::vector<ShellTerm> terms(gtos.size());
+		for (int i = 0; i < gtos.size(); ++i) {
+			terms[i] = ShellTerm{ gtos[i].e_x, gtos[i].e_y, gtos[i].e_z, gtos[i].coeff / radialNormalization(1.0, l) };
+		}
+		return terms;
+	}
+
+	std::vector<ShellTerm> cartesianShellTerms(int x, int y, int z) {
+		GTO gto(1.0, x, y, z, 1.0);
+		return std::vector<ShellTerm>{ ShellTerm{ x, y, z, gto.coeff / radialNormalization(1.0, x + y + z) } };
+	}
+
+	double Shell::radial(double r2) const {
+		double R = 0.0;
+		for (const glm::dvec2& p : primitives) R += p.y * glm::exp(-p.x * r2);
+		return R;
+	}
+
 	GTO generateCartesianGTO(double exponent, int x, int y, int z) {
 		GTO result;
 		result.e_r = exponent;
@@ -229,18 +314,59 @@ namespace mol {
 		return result;
 	}
 
+	CubeMap::CubeMap() {
+		texture.host_data = false;
+		texture.channels = 1;
+	}
+
 	CubeMap::CubeMap(glm::ivec3 resolution) {
+		texture.host_data = false;
+		texture.channels = 1;
 		resize(resolution);
 	}
 
 	void CubeMap::resize(glm::ivec3 resolution) {
 		resolution = glm::max(resolution, glm::ivec3(4));
 		texture.resize(resolution.x, resolution.y, resolution.z);
+		if (bricks.dimensions != resolution) {
+			bricks.resize(resolution);
+			stale = false;
+			readback.discard();
+		}
+	}
+
+	void CubeMap::upload() {
+		bricks.upload(texture);
+		stale = false;
+		readback.discard();
+	}
+
+	void CubeMap::invalidate() {
+		bricks.setChannels(1);
+		bricks.clear();
+		stale = true;
+		readback.discard();
+	}
+
+	void CubeMap::prefetch() {
+		if (stale && !readback.pending()) texture.readToBuffer(readback);
+	}
+
+	void CubeMap::download() {
+		if (!stale) return;
+		prefetch();
+
+		const float* values = (const float*)readback.map();
+		if (values) {
+			bricks.fromDense(values, texture.channels);
+			readback.unmap();
+		}
+		stale = false;
 	}
 
 	float CubeMap::sample(glm::ivec3 coord) {
 		coord = glm::clamp(coord, glm::ivec3(0, 0, 0), glm::ivec3(texture.width - 1, texture.height - 1, texture.depth - 1));
-		return texture.data[4 * (coord.x + (coord.y + coord.z * texture.height) * texture.width)];
+		return bricks.value(coord);
 	}
 
 	glm::vec3 CubeMap::sampleGradient(glm::ivec3 coord) {
@@ -251,7 +377,7 @@ namespace mol {
 			);
 	}
 
-	double ContractedBasis::sample(glm::dvec3 r) {
+	double ContractedBasis::sample(glm::dvec3 r) const {
 		r -= origin;
 
 		glm::dvec4 polynomial_terms[10];
@@ -265,58 +391,21 @@ namespace mol {
 		double psi = 0.;
 		double r2 = r.x * r.x + r.y * r.y + r.z * r.z;
 		for (int i = 0; i < gto_primitives.size(); ++i) {
-			GTO& p = gto_primitives[i];
+			const GTO& p = gto_primitives[i];
 			double psi_r = glm::exp(-p.e_r * r2);
 			psi += p.coeff * psi_r * polynomial_terms[p.e_x].x * polynomial_terms[p.e_y].y * polynomial_terms[p.e_z].z;
 		}
 		double R = glm::length(r);
 		for (int i = 0; i < sto_primitives.size(); ++i) {
-			STO& p = sto_primitives[i];
+			const STO& p = sto_primitives[i];
 			double psi_r = glm::exp(-2.0 * p.alpha * R);
 			psi += p.coeff * psi_r * polynomial_terms[p.e_r].w * polynomial_terms[p.e_x].x * polynomial_terms[p.e_y].y * polynomial_terms[p.e_z].z;
 		}
 		return psi;
 	}
 
-	void MolecularOrbital::writeCubeSlice(CubeMap& map, uint z_min, uint z_max, bool print_progress) const {
-		glm::ivec3 dimensions = glm::ivec3(map.texture.width, map.texture.height, map.texture.depth);
-
-		int ao_count = glm::min(lcao_coefficients.size(), basis->size());
-		for (int i = 0; i < ao_count; ++i) {
-			if (print_progress) flo::printProgress((float)(i + 1) / (float)(ao_count));
-
-			ContractedBasis& b = (*basis)[i];
-			double coeff = lcao_coefficients[i];
-			double radius = 0.0;
-			for (STO primitive : b.sto_primitives) {
-				double r = 2.5 / primitive.alpha + (double)(glm::max(primitive.e_x, glm::max(primitive.e_y, primitive.e_z)) * primitive.e_r);
-				if (r > radius) radius = r;
-			}
-			for (GTO primitive : b.gto_primitives) {
-				double r = 2.5 / glm::sqrt(primitive.e_r) + (double)glm::max(primitive.e_x, glm::max(primitive.e_y, primitive.e_z));
-				if (r > radius) radius = r;
-			}
-			glm::ivec3 min = glm::clamp(glm::ivec3(((b.origin - radius - map.origin) / map.size) * (glm::dvec3)dimensions), glm::ivec3(0, 0, z_min), glm::ivec3(dimensions.x, dimensions.y, z_max));
-			glm::ivec3 max = glm::clamp(glm::ivec3(((b.origin + radius - map.origin) / map.size) * (glm::dvec3)dimensions), glm::ivec3(0, 0, z_min), glm::ivec3(dimensions.x, dimensions.y, z_max));
-
-			for (int z = min.z; z < max.z; ++z) {
-				for (int y = min.y; y < max.y; ++y) {
-					for (int x = min.x; x < max.x; ++x) {
-						glm::dvec3 p = map.origin + map.size * glm::dvec3(x + 0.5, y + 0.5, z + 0.5) / glm::dvec3(dimensions);
-						double phi = b.sample(p);
-
-						map.texture.data[4 * (x + map.texture.width * (y + map.texture.height * z))] += coeff * phi;
-					}
-				}
-			}
-		}
-	}
-
-	void MolecularOrbital::threadWriteCubeSlice(MolecularOrbital* mo, CubeMap* cubemap, uint z_min, uint z_max) {
-		mo->writeCubeSlice(*cubemap, z_min, z_max);
-	}
-
-	void fitCubeMap(CubeMap& map, std::vector<ContractedBasis>& basis) {
+	void fitCubeMap(CubeMap& map, const std::vector<ContractedBasis>& basis) {
+		map.axes = glm::dmat3(1.0);
 		map.origin = basis[0].origin;
 		map.size = basis[0].origin;
 
@@ -337,6 +426,277 @@ namespace mol {
 		if (resize_cubemap) map.resize(glm::ivec3((glm::vec3)map.size * settings.cubemap_density));
 	}
 
+	// Eigenvectors of the covariance of the basis function centers as columns, by decreasing variance. The frame is right-handed.
+	glm::dmat3 principalAxes(const std::vector<ContractedBasis>& basis) {
+		glm::dvec3 mean(0.0);
+		for (const ContractedBasis& b : basis) mean += b.origin;
+		mean /= (double)basis.size();
+
+		glm::dmat3 a(0.0);
+		for (const ContractedBasis& b : basis) a += glm::outerProduct(b.origin - mean, b.origin - mean);
+
+		// Jacobi rotations, a converges to the eigenvalues and v to the eigenvectors.
+		glm::dmat3 v(1.0);
+		for (int sweep = 0; sweep < 32; ++sweep) {
+			const double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+			if (off <= 1e-30 * (a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2]) || off == 0.0) break;
+
+			for (int p = 0; p < 2; ++p) {
+				for (int q = p + 1; q < 3; ++q) {
+					if (a[p][q] == 0.0) continue;
+					const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+					const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+					const double c = 1.0 / std::sqrt(t * t + 1.0);
+					const double s = t * c;
+
+					glm::dmat3 rotation(1.0);
+					rotation[p][p] = c;
+					rotation[q][q] = c;
+					rotation[q][p] = s;
+					rotation[p][q] = -s;
+					a = glm::transpose(rotation) * a * rotation;
+					v = v * rotation;
+				}
+			}
+		}
+
+		int order[3] = { 0, 1, 2 };
+		std::sort(order, order + 3, [&a](int i, int j) { return a[i][i] > a[j][j]; });
+		glm::dmat3 axes;
+		for (int i = 0; i < 2; ++i) {
+			axes[i] = v[order[i]];
+			// The largest component points along the positive world axis, so similar molecules get similar frames.
+			const glm::dvec3 m = glm::abs(axes[i]);
+			const int largest = m.x >= m.y && m.x >= m.z ? 0 : (m.y >= m.z ? 1 : 2);
+			if (axes[i][largest] < 0.0) axes[i] = -axes[i];
+		}
+		axes[2] = glm::cross(axes[0], axes[1]);
+		return axes;
+	}
+
+	// Terms of weight x^e_x y^e_y z^e_z in the frame of axes: with x, y and z the world coordinates of axes * q, a polynomial in q of the same degree.
+	void rotateMonomial(int e_x, int e_y, int e_z, double weight, const glm::dmat3& axes, std::vector<ShellTerm>& out) {
+		std::vector<ShellTerm> terms = { ShellTerm{ 0, 0, 0, weight } };
+		const int exponents[3] = { e_x, e_y, e_z };
+		for (int axis = 0; axis < 3; ++axis) {
+			for (int k = 0; k < exponents[axis]; ++k) {
+				std::vector<ShellTerm> product;
+				for (const ShellTerm& t : terms) {
+					for (int j = 0; j < 3; ++j) {
+						if (axes[j][axis] != 0.0) product.push_back(ShellTerm{ t.e_x + (j == 0), t.e_y + (j == 1), t.e_z + (j == 2), t.weight * axes[j][axis] });
+					}
+				}
+				terms.swap(product);
+			}
+		}
+		out.insert(out.end(), terms.begin(), terms.end());
+	}
+
+	// Sums terms with the same exponents and drops those that cancel.
+	std::vector<ShellTerm> mergeTerms(std::vector<ShellTerm> terms) {
+		std::sort(terms.begin(), terms.end(), [](const ShellTerm& a, const ShellTerm& b) {
+			return std::tie(a.e_x, a.e_y, a.e_z) < std::tie(b.e_x, b.e_y, b.e_z);
+		});
+
+		double largest = 0.0;
+		std::vector<ShellTerm> merged;
+		for (const ShellTerm& t : terms) {
+			if (merged.size() && merged.back().e_x == t.e_x && merged.back().e_y == t.e_y && merged.back().e_z == t.e_z) merged.back().weight += t.weight;
+			else merged.push_back(t);
+			largest = glm::max(largest, std::abs(t.weight));
+		}
+
+		std::vector<ShellTerm> result;
+		for (const ShellTerm& t : merged) {
+			if (std::abs(t.weight) > 1e-14 * largest) result.push_back(t);
+		}
+		return result;
+	}
+
+	// Writes basis and shells in the frame of axes into frame_basis and frame_shells. Centers move to transpose(axes) * origin,
+	// the angular parts of primitives and shell components are expanded in the coordinates of the frame.
+	void rotateBasis(const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const glm::dmat3& axes) {
+		const glm::dmat3 inverse = glm::transpose(axes);
+
+		frame_basis.assign(basis.size(), ContractedBasis());
+		for (uint i = 0; i < basis.size(); ++i) {
+			ContractedBasis& b = frame_basis[i];
+			b.origin = inverse * basis[i].origin;
+
+			for (const GTO& p : basis[i].gto_primitives) {
+				std::vector<ShellTerm> terms;
+				rotateMonomial(p.e_x, p.e_y, p.e_z, p.coeff, axes, terms);
+				for (const ShellTerm& t : mergeTerms(terms)) {
+					GTO rotated = p;
+					rotated.e_x = t.e_x;
+					rotated.e_y = t.e_y;
+					rotated.e_z = t.e_z;
+					rotated.coeff = t.weight;
+					b.gto_primitives.push_back(rotated);
+				}
+			}
+			for (const STO& p : basis[i].sto_primitives) {
+				std::vector<ShellTerm> terms;
+				rotateMonomial(p.e_x, p.e_y, p.e_z, p.coeff, axes, terms);
+				for (const ShellTerm& t : mergeTerms(terms)) {
+					STO rotated = p;
+					rotated.e_x = t.e_x;
+					rotated.e_y = t.e_y;
+					rotated.e_z = t.e_z;
+					rotated.coeff = t.weight;
+					b.sto_primitives.push_back(rotated);
+				}
+			}
+		}
+
+		frame_shells.clear();
+		if (!shells) return;
+		frame_shells = *shells;
+		for (Shell& shell : frame_shells) {
+			shell.origin = inverse * shell.origin;
+			for (std::vector<ShellTerm>& component : shell.components) {
+				std::vector<ShellTerm> terms;
+				for (const ShellTerm& t : component) rotateMonomial(t.e_x, t.e_y, t.e_z, t.weight, axes, terms);
+				component = mergeTerms(terms);
+			}
+		}
+	}
+
+	// The basis set and shells to evaluate a cubemap with, in the frame of its axes.
+	struct CubeFrame {
+		const std::vector<ContractedBasis>* basis = nullptr;
+		const std::vector<Shell>* shells = nullptr;
+		// Mirror planes of the molecule in the frame of the map, which is centered on them.
+		Symmetry symmetry;
+	};
+
+	// Fits the map like fitCubeMap(), or if settings.cubemap_fit_axes is set, along either the principal axes of the basis or the x, y and z axes,
+	// whichever takes fewer voxels. The box then covers the screened extent of every basis function that enters the map by more than its share of the
+	// tolerance, but at most cubemap_clearance around its center. weights are the magnitudes by which the functions enter, like the LCAO coefficients
+	// of an orbital, nullptr counts all of them fully. With settings.cubemap_symmetry, the frame with more mirror planes of the molecule is preferred
+	// and the box is centered on them. Returns the basis set and shells to evaluate the map with, rotated copies if the map is rotated.
+	CubeFrame fitCubeFrame(CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<double>* weights) {
+		if (!settings.cubemap_fit_axes && !settings.cubemap_symmetry) {
+			fitCubeMap(map, basis);
+			return CubeFrame{ &basis, shells, Symmetry() };
+		}
+
+		if (frame_source != &basis) {
+			frame_axes = principalAxes(basis);
+			rotateBasis(basis, shells, frame_axes);
+			frame_source = &basis;
+			// Both caches are keyed by the basis set, which now holds another frame.
+			ao_cache.clear();
+#if USE_COMPUTE_SHADERS
+			uploaded_basis = nullptr;
+#endif
+		}
+
+		std::vector<double> radii(basis.size(), settings.cubemap_clearance);
+		if (settings.cubemap_fit_axes && settings.cubemap_tolerance > 0.f) {
+			const double share = settings.cubemap_tolerance / glm::max((double)basis.size(), 1.0);
+			for (uint i = 0; i < basis.size(); ++i) {
+				const double weight = !weights ? 1.0 : (i < weights->size() ? std::abs((*weights)[i]) : 0.0);
+				radii[i] = weight > 0.0 ? glm::min(radii[i], screeningRadius(basisBound(basis[i]), share / weight)) : 0.0;
+			}
+		}
+
+		glm::dvec3 low[2], high[2];
+		double volume[2];
+		Symmetry symmetry[2];
+		for (int frame = 0; frame < 2; ++frame) {
+			const std::vector<ContractedBasis>& centers = frame ? frame_basis : basis;
+			low[frame] = glm::dvec3(std::numeric_limits<double>::max());
+			high[frame] = glm::dvec3(-std::numeric_limits<double>::max());
+			for (uint i = 0; i < basis.size(); ++i) {
+				if (radii[i] <= 0.0) continue;
+				low[frame] = glm::min(low[frame], centers[i].origin - radii[i]);
+				high[frame] = glm::max(high[frame], centers[i].origin + radii[i]);
+			}
+			// Nothing is left after screening, the map only has to exist.
+			if (low[frame].x > high[frame].x) {
+				low[frame] = centers[0].origin - (double)settings.cubemap_clearance;
+				high[frame] = centers[0].origin + (double)settings.cubemap_clearance;
+			}
+			if (settings.cubemap_symmetry) {
+				symmetry[frame] = findSymmetry(molecule.atoms, frame ? frame_axes : glm::dmat3(1.0));
+				// Atom positions are single precision, the planes pass through the centroid of the basis functions, which is just as symmetric.
+				glm::dvec3 centroid(0.0);
+				for (const ContractedBasis& b : centers) centroid += b.origin;
+				symmetry[frame].center = centroid / (double)centers.size();
+				centerBox(symmetry[frame], low[frame], high[frame]);
+			}
+			const glm::dvec3 size = high[frame] - low[frame];
+			volume[frame] = size.x * size.y * size.z;
+		}
+
+		int frame = settings.cubemap_fit_axes && volume[1] < volume[0] ? 1 : 0;
+		if (symmetry[0].count() != symmetry[1].count()) frame = symmetry[1].count() > symmetry[0].count() ? 1 : 0;
+		map.axes = frame ? frame_axes : glm::dmat3(1.0);
+		map.origin = low[frame];
+		map.size = high[frame] - low[frame];
+		if (resize_cubemap) map.resize(glm::ivec3((glm::vec3)map.size * settings.cubemap_density));
+
+		if (!frame) return CubeFrame{ &basis, shells, symmetry[0] };
+		return CubeFrame{ &frame_basis, frame_shells.size() ? &frame_shells : nullptr, symmetry[1] };
+	}
+
+	// Points to compare a map with its mirror images at, next to the centers of the basis functions, where the values are largest.
+	std::vector<glm::dvec3> symmetrySamples(const std::vector<ContractedBasis>& basis) {
+		const glm::dvec3 offsets[2] = { glm::dvec3(0.37, 0.23, 0.51), glm::dvec3(-0.29, 0.44, -0.17) };
+		const uint stride = glm::max((uint)basis.size() / 32u, 1u);
+
+		std::vector<glm::dvec3> samples;
+		for (uint i = 0; i < basis.size(); i += stride) {
+			for (const glm::dvec3& offset : offsets) samples.push_back(basis[i].origin + offset);
+		}
+		return samples;
+	}
+
+	// Keeps the mirror planes of the frame that the orbital follows, with their characters.
+	Symmetry orbitalSymmetry(const CubeFrame& frame, const std::vector<double>& coefficients) {
+		Symmetry symmetry = frame.symmetry;
+		if (!symmetry.mirrors) return symmetry;
+		const std::vector<ContractedBasis>& basis = *frame.basis;
+		verifySymmetry(symmetry, [&](const glm::dvec3& p) {
+			double psi = 0.0;
+			for (uint i = 0; i < glm::min(coefficients.size(), basis.size()); ++i) {
+				if (coefficients[i] != 0.0) psi += coefficients[i] * basis[i].sample(p);
+			}
+			return psi;
+		}, symmetrySamples(basis), settings.cubemap_tolerance);
+		return symmetry;
+	}
+
+	// Keeps the mirror planes of the frame that the density of the channel follows.
+	Symmetry densitySymmetry(const CubeFrame& frame, DensityChannel channel) {
+		Symmetry symmetry = frame.symmetry;
+		if (!symmetry.mirrors) return symmetry;
+		const std::vector<ContractedBasis>& basis = *frame.basis;
+		std::vector<double> phi(basis.size());
+		verifySymmetry(symmetry, [&](const glm::dvec3& p) {
+			for (uint i = 0; i < basis.size(); ++i) phi[i] = basis[i].sample(p);
+			double rho = 0.0;
+			for (const MolecularOrbital& mo : mos) {
+				const double occupation = channelOccupation(mo, channel);
+				if (occupation == 0.0) continue;
+				double psi = 0.0;
+				for (uint i = 0; i < glm::min(mo.lcao_coefficients.size(), basis.size()); ++i) psi += mo.lcao_coefficients[i] * phi[i];
+				rho += occupation * psi * psi;
+			}
+			return rho;
+		}, symmetrySamples(basis), settings.cubemap_tolerance);
+		return symmetry;
+	}
+
+	// Tiles to evaluate for the symmetry, all tiles of the map if there is none.
+	std::vector<uint> symmetryTiles(const CubeMap& map, const Symmetry& symmetry) {
+		if (symmetry.mirrors) return uniqueTiles(map.bricks, symmetry);
+		std::vector<uint> tiles(map.bricks.bricks.size());
+		for (uint i = 0; i < tiles.size(); ++i) tiles[i] = i;
+		return tiles;
+	}
+
 	void generateSliceVertexArrays(std::vector<fgr::VertexArray>& vas, uint total_slices) {
 		vas.resize(settings.cubemap_slice_count);
 		for (int i = 0; i < vas.size(); ++i) {
@@ -362,94 +722,37 @@ namespace mol {
 		}
 	}
 
-	void drawSlicesToFBO(std::vector<fgr::VertexArray>& vas, fgr::RenderTarget& fbo, fgr::Shader& shader, fgr::ComputeShader& compute, CubeMap& cubemap) {
-#if USE_COMPUTE_SHADERS
-		compute.bindImage(0, cubemap.texture.id, true, true, true, GL_RGBA16F);
-		compute.dispatch();
-#else
+	void drawSlicesToFBO(std::vector<fgr::VertexArray>& vas, fgr::RenderTarget& fbo, fgr::Shader& shader) {
 		fbo.bind();
-		for (auto va : vas)
+		for (fgr::VertexArray& va : vas)
 			va.draw(shader);
 		fbo.unbind();
-#endif
-		fgr::waitForDrawCalls();
 	}
 
-	void setGTOUniforms(glm::vec3* origins, glm::vec3* exponents3, float* alpha, float* coeffs, uint primitive_count) {
 #if USE_COMPUTE_SHADERS
-		gto_compute.setVec3Array(2, origins, primitive_count);
-		gto_compute.setVec3Array(3, exponents3, primitive_count);
-		gto_compute.setFloatArray(4, alpha, primitive_count);
-		gto_compute.setFloatArray(5, coeffs, primitive_count);
-#else
-		gto_shader.setVec3Array(3, origins, primitive_count);
-		gto_shader.setVec3Array(4, exponents3, primitive_count);
-		gto_shader.setFloatArray(5, alpha, primitive_count);
-		gto_shader.setFloatArray(6, coeffs, primitive_count);
-#endif
+	void loadShader(bool sto) {
+		fgr::ComputeShader& compute = sto ? sto_compute : gto_compute;
+		if (!compute.loaded) {
+			compute = fgr::ComputeShader(sto ? "shaders/volumol/sto.comp" : "shaders/volumol/gto.comp", std::vector<std::string>{
+				"cubemap_origin",	// 0
+				"cubemap_size",		// 1
+				"dimensions",		// 2
+				"first_layer",		// 3
+			});
+			compute.compile();
+		}
 	}
-
-	void setSTOUniforms(glm::vec3* origins, glm::vec4* exponents4, float* alpha, float* coeffs, uint primitive_count) {
-#if USE_COMPUTE_SHADERS
-		sto_compute.setVec3Array(2, origins, primitive_count);
-		sto_compute.setVec4Array(3, exponents4, primitive_count);
-		sto_compute.setFloatArray(4, alpha, primitive_count);
-		sto_compute.setFloatArray(5, coeffs, primitive_count);
 #else
-		sto_shader.setVec3Array(3, origins, primitive_count);
-		sto_shader.setVec4Array(4, exponents4, primitive_count);
-		sto_shader.setFloatArray(5, alpha, primitive_count);
-		sto_shader.setFloatArray(6, coeffs, primitive_count);
-#endif
-	}
-
 	void loadShader(bool sto, CubeMap& cubemap) {
-#if USE_COMPUTE_SHADERS
-		if (sto) {
-			if (!sto_compute.loaded) {
-				sto_compute = fgr::ComputeShader("shaders/volumol/sto.comp", std::vector<std::string>{
-					"cubemap_origin",	// 0
-					"cubemap_size",		// 1
-					"origin",			// 2
-					"exponents",		// 3
-					"alpha",			// 4
-					"coeff",			// 5
-				});
-				sto_shader.compile();
-			}
-
-			sto_compute.setVec3(0, cubemap.origin);
-			sto_compute.setVec3(1, cubemap.size);
-			sto_compute.work_group_count = glm::uvec3((glm::ivec3(cubemap.texture.width, cubemap.texture.height, cubemap.texture.depth) + 3) / 4);
-		}
-		else {
-			if (!gto_compute.loaded) {
-				gto_compute = fgr::ComputeShader("shaders/volumol/gto.comp", std::vector<std::string>{
-					"cubemap_origin",	// 0
-					"cubemap_size",		// 1
-					"origin",			// 2
-					"exponents",		// 3
-					"alpha",			// 4
-					"coeff",			// 5
-				});
-				gto_compute.compile();
-			}
-
-			gto_compute.setVec3(0, cubemap.origin);
-			gto_compute.setVec3(1, cubemap.size);
-			gto_compute.work_group_count = glm::uvec3((glm::ivec3(cubemap.texture.width, cubemap.texture.height, cubemap.texture.depth) + 3) / 4);
-		}
-#else
 		if (sto) {
 			if (!sto_shader.loaded) {
 				sto_shader = fgr::Shader("shaders/volumol/gto.vert", "shaders/volumol/sto.frag", "shaders/volumol/gto.geom", std::vector<std::string>{
 					"cubemap_origin",	// 0
 					"cubemap_size",		// 1
 					"layer_count",		// 2
-					"origin",			// 3
-					"exponents",		// 4
-					"alpha",			// 5
-					"coeff",			// 6
+					"primitives",		// 3
+					"first_primitive",	// 4
+					"primitive_count",	// 5
 				});
 				sto_shader.compile();
 			}
@@ -464,10 +767,9 @@ namespace mol {
 					"cubemap_origin",	// 0
 					"cubemap_size",		// 1
 					"layer_count",		// 2
-					"origin",			// 3
-					"exponents",		// 4
-					"alpha",			// 5
-					"coeff",			// 6
+					"primitives",		// 3
+					"first_primitive",	// 4
+					"primitive_count",	// 5
 				});
 				gto_shader.compile();
 			}
@@ -476,288 +778,852 @@ namespace mol {
 			gto_shader.setVec3(1, cubemap.size);
 			gto_shader.setInt(2, cubemap.texture.depth);
 		}
+	}
 #endif
+
+#if USE_COMPUTE_SHADERS
+	void uploadBasis(const std::vector<ContractedBasis>& basis, bool use_stos) {
+		if (uploaded_basis == &basis && uploaded_stos == use_stos) return;
+
+		std::vector<GPUPrimitive>& primitives = uploaded_primitives;
+		primitives.clear();
+		for (uint i = 0; i < basis.size(); ++i) {
+			const ContractedBasis& b = basis[i];
+			if (use_stos) {
+				for (const STO& sto : b.sto_primitives) primitives.push_back(GPUPrimitive{ b.origin, (float)sto.alpha, glm::ivec4(sto.e_x, sto.e_y, sto.e_z, sto.e_r), (float)sto.coeff, (int)i, { 0, 0 } });
+			}
+			else {
+				for (const GTO& gto : b.gto_primitives) primitives.push_back(GPUPrimitive{ b.origin, (float)gto.e_r, glm::ivec4(gto.e_x, gto.e_y, gto.e_z, 0), (float)gto.coeff, (int)i, { 0, 0 } });
+			}
+		}
+
+		primitive_buffer.setData(primitives.data(), primitives.size() * sizeof(GPUPrimitive));
+		uploaded_basis = &basis;
+		uploaded_stos = use_stos;
 	}
 
-	void MolecularOrbital::writeCubeMap(CubeMap& map, bool print_progress) {
-		if (!basis) return;
-		if (!basis->size()) return;
+	// Distance beyond which a primitive is left out of the bins, 0 if it can be left out everywhere.
+	float cullRadius(const GPUPrimitive& p, double coefficient, double limit) {
+		const double c = std::abs(coefficient * p.coeff);
+		if (c == 0.0) return 0.f;
 
-		fitCubeMap(map, *basis);
+		// The shaders evaluate STOs as R^n exp(-alpha R).
+		const int degree = p.exponents.x + p.exponents.y + p.exponents.z;
+		const bool sto = uploaded_stos;
+		if (limit > 0.0) return screeningRadius({ sto ? RadialBound{ c, degree + p.exponents.w, p.alpha, 1 } : RadialBound{ c, degree, p.alpha, 2 } }, limit);
 
-		glm::ivec3 dimensions = glm::ivec3(map.texture.width, map.texture.height, map.texture.depth);
+		// Without a tolerance, the extents match those of the CPU.
+		const int largest = glm::max(p.exponents.x, glm::max(p.exponents.y, p.exponents.z));
+		return sto ? 5.f / p.alpha + (float)(largest * p.exponents.w) : 2.5f / std::sqrt(p.alpha) + (float)largest;
+	}
 
-		if (settings.cubemap_use_gpu) {
+	// Sorts the primitives into bins on the GPU. The first pass counts the primitives of every bin, the second one writes the lists.
+	void binPrimitives(const CubeMap& map, const glm::ivec3& bins) {
+		if (!cull_compute.loaded) {
+			cull_compute = fgr::ComputeShader("shaders/volumol/cull.comp", std::vector<std::string>{
+				"cubemap_origin",	// 0
+				"cubemap_size",		// 1
+				"dimensions",		// 2
+				"primitive_count",	// 3
+				"fill",				// 4
+			});
+			cull_compute.compile();
+		}
 
-			loadShader(use_stos, map);
+		const uint bin_count = bins.x * bins.y * bins.z;
+		bin_offsets.reserve((bin_count + 1) * sizeof(uint));
+
+		primitive_buffer.bind(0);
+		radius_buffer.bind(5);
+		bin_offsets.bind(3);
+
+		cull_compute.setVec3(0, map.origin);
+		cull_compute.setVec3(1, map.size);
+		cull_compute.setVec3(2, glm::vec3(map.texture.width, map.texture.height, map.texture.depth));
+		cull_compute.setInt(3, uploaded_primitives.size());
+		cull_compute.work_group_count = glm::uvec3(bins);
+
+		cull_compute.setInt(4, false);
+		cull_compute.dispatch();
+
+		std::vector<uint> offsets(bin_count + 1, 0);
+		bin_offsets.getData(offsets.data(), bin_count * sizeof(uint));
+		uint total = 0;
+		for (uint i = 0; i <= bin_count; ++i) {
+			const uint count = i < bin_count ? offsets[i] : 0;
+			offsets[i] = total;
+			total += count;
+		}
+		bin_offsets.setData(offsets.data(), offsets.size() * sizeof(uint));
+		bin_lists.reserve(glm::max(total, 1u) * sizeof(uint));
 
-			if (print_progress) {
-#if USE_COMPUTE_SHADERS
-				std::cout << "Using compute shaders for rendering\nProgress:\n";
-#else
-				std::cout << "Using geometry shaders for rendering\nProgress\n";
-#endif
-			}
+		bin_lists.bind(4);
+		cull_compute.setInt(4, true);
+		cull_compute.dispatch();
+	}
+
+	// Uploads the coefficients, bins the primitives for the grid of the map and binds everything the shader reads. Returns the dimensions of the grid.
+	// lcao holds the coefficients of orbital_count orbitals one after another, primitives are culled by the largest of them.
+	glm::ivec3 prepareCompute(fgr::ComputeShader& compute, const std::vector<float>& lcao, uint orbital_count, CubeMap& map) {
+		coefficient_buffer.setData(lcao.data(), lcao.size() * sizeof(float));
+
+		// Each primitive gets its share of the tolerance, like in the CPU screening.
+		const uint primitive_count = uploaded_primitives.size();
+		const uint function_count = uploaded_basis->size();
+		const double limit = settings.cubemap_tolerance / glm::max(primitive_count, 1u);
+		std::vector<float> radii(primitive_count, 0.f);
+		for (uint i = 0; i < primitive_count; ++i) {
+			const GPUPrimitive& p = uploaded_primitives[i];
+			for (uint o = 0; o < orbital_count; ++o) radii[i] = glm::max(radii[i], cullRadius(p, lcao[o * function_count + p.function], limit));
+		}
+		radius_buffer.setData(radii.data(), radii.size() * sizeof(float));
+
+		const glm::ivec3 dimensions = glm::ivec3(map.texture.width, map.texture.height, map.texture.depth);
+		const glm::ivec3 bins = (dimensions + bin_size - 1) / bin_size;
+		binPrimitives(map, bins);
+
+		const size_t voxels = (size_t)dimensions.x * dimensions.y * dimensions.z;
+		value_buffer.reserve(voxels * sizeof(float));
+
+		primitive_buffer.bind(0);
+		coefficient_buffer.bind(1);
+		value_buffer.bind(2);
+		bin_offsets.bind(3);
+		bin_lists.bind(4);
+
+		compute.setVec3(0, map.origin);
+		compute.setVec3(1, map.size);
+		compute.setVec3(2, glm::vec3(dimensions));
+
+		return dimensions;
+	}
+
+	// Evaluates layer_count layers of voxels from first_layer on into value_buffer and waits for them. first_layer has to start a bin.
+	void dispatchLayers(fgr::ComputeShader& compute, const glm::ivec3& dimensions, int first_layer, int layer_count) {
+		compute.work_group_count = glm::uvec3((dimensions.x + 3) / 4, (dimensions.y + 3) / 4, (layer_count + 3) / 4);
+		compute.setInt(3, first_layer);
+		compute.dispatch();
+		fgr::waitForDrawCalls();
+	}
+
+	// Slabs of layers keep single dispatches short and allow for progress reports. They have to cover whole bins.
+	constexpr int slab_layers = 2 * bin_size;
 
-			std::vector<fgr::VertexArray> vas;
-			generateSliceVertexArrays(vas, dimensions.z);
+	// Evaluates a shader that stores one value per voxel from the primitives of its bin, so every voxel is stored exactly once and in single precision.
+	void evaluateCompute(fgr::ComputeShader& compute, const std::vector<float>& lcao, uint orbital_count, CubeMap& map, bool print_progress) {
+		const glm::ivec3 dimensions = prepareCompute(compute, lcao, orbital_count, map);
 
-			if (!map.texture.id) {
-				map.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
+		for (int z = 0; z < dimensions.z; z += slab_layers) {
+			dispatchLayers(compute, dimensions, z, slab_layers);
+			if (print_progress) flo::printProgress((float)glm::min(z + slab_layers, dimensions.z) / (float)dimensions.z);
+		}
+
+		// The values go from the storage buffer into the texture on the GPU, the bricks are only fetched when they are needed.
+		// The texture holds half floats, so the readback is copied from the storage buffer to keep the bricks in single precision.
+		if (!map.texture.id) map.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
+		map.texture.setFromBuffer(value_buffer.id);
+		map.invalidate();
+		map.readback.copyFromBuffer(value_buffer.id, (size_t)dimensions.x * dimensions.y * dimensions.z * sizeof(float));
+	}
+
+	// Like evaluateCompute(), but the CPU threads evaluate part of the grid with cpu at the same time. The GPU takes slabs of bricks from the top
+	// and the CPU single layers of bricks from the bottom, each side claims more once it is done, so the split follows the throughput of both.
+	// The slabs of the GPU are copied into the bricks, which are uploaded at the end.
+	void evaluateHybrid(fgr::ComputeShader& compute, const std::vector<float>& lcao, uint orbital_count, CubeMap& map, const TileFunction& cpu, bool print_progress) {
+		static_assert(slab_layers % tile_size == 0, "Slabs have to consist of whole layers of bricks");
+
+		const glm::ivec3 dimensions = prepareCompute(compute, lcao, orbital_count, map);
+		BrickMap& bricks = map.bricks;
+		bricks.setChannels(1);
+		const uint layer_bricks = bricks.brick_count.x * bricks.brick_count.y;
+		const int layer_count = bricks.brick_count.z;
+
+		// Layers below low are taken by the CPU, layers from high on by the GPU.
+		std::mutex mutex;
+		int low = 0, high = layer_count;
+		std::atomic<int> finished = 0;
+
+		std::future<void> cpu_side = std::async(std::launch::async, [&]() {
+			std::vector<uint> tiles(layer_bricks);
+			while (true) {
+				int layer = 0;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (low >= high) return;
+					layer = low++;
+				}
+				for (uint i = 0; i < layer_bricks; ++i) tiles[i] = i + layer_bricks * layer;
+				cpu(map, tiles, nullptr);
+				++finished;
+			}
+		});
+
+		// GL calls stay on this thread.
+		const size_t layer_voxels = (size_t)dimensions.x * dimensions.y;
+		std::vector<float> values;
+		int gpu_layers = 0;
+		while (true) {
+			int first = 0, count = 0;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (low >= high) break;
+				count = glm::min(slab_layers / tile_size, high - low);
+				high -= count;
+				first = high;
 			}
+			const int z_min = first * tile_size;
+			const int z_max = glm::min((first + count) * tile_size, dimensions.z);
+			dispatchLayers(compute, dimensions, z_min, z_max - z_min);
 
-			fgr::RenderTarget fbo = map.texture.createFrameBuffer();
-			fbo.clear(glm::vec4(0.), false);
+			values.resize(layer_voxels * (z_max - z_min));
+			value_buffer.getData(values.data(), values.size() * sizeof(float), layer_voxels * z_min * sizeof(float));
+			bricks.fromDenseLayers(values.data(), 1, first, count);
 
-			fgr::setBlending(fgr::Blending::none);
-			fgr::setDepthTesting(false);
+			gpu_layers += count;
+			finished += count;
+			if (print_progress) flo::printProgress((float)finished / (float)layer_count);
+		}
+		cpu_side.get();
 
-			constexpr uint primitive_count = 16;
-			glm::vec3 origins[primitive_count];
-			glm::vec3 exponents3[primitive_count];
-			glm::vec4 exponents4[primitive_count];
-			float alpha[primitive_count];
-			float coeffs[primitive_count];
-			int index = 0;
+		if (print_progress) {
+			flo::printProgress(1.f);
+			std::cout << "\nThe GPU evaluated " << gpu_layers << " of " << layer_count << " layers of bricks";
+		}
+		map.upload();
+	}
 
-			int ao_count = glm::min(lcao_coefficients.size(), basis->size());
+	// If cpu is given, the CPU threads take part, see evaluateHybrid().
+	void writeOrbitalCompute(const std::vector<double>& coefficients, CubeMap& map, const std::vector<ContractedBasis>& basis, bool use_stos, bool print_progress, const TileFunction* cpu = nullptr) {
+		uploadBasis(basis, use_stos);
 
-			if (use_stos) {
-				for (int i = 0; i < ao_count; ++i) {
-					ContractedBasis& b = (*basis)[i];
-					double coeff = lcao_coefficients[i];
+		std::vector<float> lcao(basis.size(), 0.f);
+		for (uint i = 0; i < glm::min(coefficients.size(), basis.size()); ++i) lcao[i] = (float)coefficients[i];
+		if (cpu) evaluateHybrid(use_stos ? sto_compute : gto_compute, lcao, 1, map, *cpu, print_progress);
+		else evaluateCompute(use_stos ? sto_compute : gto_compute, lcao, 1, map, print_progress);
+	}
+
+	// Accumulates occupation * psi^2 of all orbitals in one kernel, which evaluates each primitive once for several orbitals at a time.
+	void writeDensityCompute(const std::vector<const MolecularOrbital*>& orbitals, const std::vector<double>& occupations, CubeMap& map, const std::vector<ContractedBasis>& basis, bool use_stos, const TileFunction* cpu = nullptr) {
+		if (!density_compute.loaded) {
+			density_compute = fgr::ComputeShader("shaders/volumol/density.comp", std::vector<std::string>{
+				"cubemap_origin",	// 0
+				"cubemap_size",		// 1
+				"dimensions",		// 2
+				"first_layer",		// 3
+				"orbital_count",	// 4
+				"function_count",	// 5
+				"slater",			// 6
+			});
+			density_compute.compile();
+		}
+		uploadBasis(basis, use_stos);
+
+		std::vector<float> lcao(orbitals.size() * basis.size(), 0.f);
+		for (uint o = 0; o < orbitals.size(); ++o) {
+			const std::vector<double>& coefficients = orbitals[o]->lcao_coefficients;
+			for (uint i = 0; i < glm::min(coefficients.size(), basis.size()); ++i) lcao[o * basis.size() + i] = (float)coefficients[i];
+		}
+		const std::vector<float> occupation_values(occupations.begin(), occupations.end());
+		occupation_buffer.setData(occupation_values.data(), occupation_values.size() * sizeof(float));
+		occupation_buffer.bind(6);
+
+		density_compute.setInt(4, orbitals.size());
+		density_compute.setInt(5, basis.size());
+		density_compute.setInt(6, use_stos);
+		if (cpu) evaluateHybrid(density_compute, lcao, orbitals.size(), map, *cpu, true);
+		else evaluateCompute(density_compute, lcao, orbitals.size(), map, true);
+	}
+#endif
+
+	void updateAOCache(const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, bool print_progress) {
+		if (ao_cache.matches(map, &basis)) return;
 
-					for (STO sto : b.sto_primitives) {
-						exponents4[index] = glm::vec4(sto.e_x, sto.e_y, sto.e_z, sto.e_r);
-						alpha[index] = sto.alpha;
-						coeffs[index] = sto.coeff * coeff;
-						origins[index] = b.origin;
-						++index;
+		if (print_progress) std::cout << "Caching basis functions on the grid\n";
+		ao_cache.build(map, basis, shells);
+		if (print_progress) std::cout << "Basis function cache uses " << ao_cache.memory() / (1024 * 1024) << " MB\n";
+	}
 
-						if (index == primitive_count) {
-							index = 0;
+	void clearAOCache() {
+		ao_cache.clear();
+		frame_source = nullptr;
+#if USE_COMPUTE_SHADERS
+		uploaded_basis = nullptr;
+#endif
+		density_record.valid = false;
+		density_total.clear();
+		density_spin.clear();
+	}
 
-							setSTOUniforms(origins, exponents4, alpha, coeffs, primitive_count);
+	GridEvaluator orbitalEvaluator(const std::vector<double>& coefficients, const CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells,
+		const EvaluationSettings& options) {
+		GridEvaluator evaluator(map, basis, shells, coefficients, options.separable, false, options.tolerance);
+		evaluator.single_precision = options.single_precision;
+		return evaluator;
+	}
 
-							if (print_progress) flo::printProgress((float)(i + 1) / (float)(ao_count));
+	// Writes the tiles of an evaluator that may be kept for several calls on the same map.
+	void writeOrbitalTiles(const GridEvaluator& evaluator, CubeMap& map, const std::vector<uint>& tiles, const std::atomic<bool>* cancel = nullptr) {
+		const TileGrid& grid = evaluator.grid;
 
-							drawSlicesToFBO(vas, fbo, sto_shader, sto_compute, map);
+		forEachTile(tiles.size(), [&](uint i) {
+			std::vector<uint> list;
+			evaluator.listFunctions(grid.tileMin(tiles[i]), grid.tileMax(tiles[i]), list);
+			evaluator.evaluateTile(tiles[i], list, map.bricks);
+		}, cancel);
+	}
 
-							fgr::setBlending(fgr::Blending::additive);
-						}
-					}
-				}
+	void writeOrbitalTiles(const std::vector<double>& coefficients, CubeMap& map, const std::vector<ContractedBasis>& basis, const std::vector<Shell>* shells, const std::vector<uint>& tiles,
+		const EvaluationSettings& options, const std::atomic<bool>* cancel = nullptr) {
+		writeOrbitalTiles(orbitalEvaluator(coefficients, map, basis, shells, options), map, tiles, cancel);
+	}
 
-				if (index) {
-					for (int i = index; i < primitive_count; ++i) {
-						origins[i] = glm::vec3(0.0);
-						exponents4[i] = glm::vec4(0.0);
-						alpha[i] = 0.f;
-						coeffs[i] = 0.f;
-					}
+#if !USE_COMPUTE_SHADERS
+	// Draws an orbital into the texture of the map with the geometry shaders, without waiting for the draws or reading the texture back.
+	// basis is the basis set of the orbital in the frame of the map.
+	void drawOrbital(const MolecularOrbital& mo, CubeMap& map, const std::vector<ContractedBasis>& basis, bool print_progress) {
+		loadShader(mo.use_stos, map);
 
-					setSTOUniforms(origins, exponents4, alpha, coeffs, primitive_count);
+		std::vector<fgr::VertexArray> vas;
+		generateSliceVertexArrays(vas, map.texture.depth);
 
-					drawSlicesToFBO(vas, fbo, sto_shader, sto_compute, map);
+		if (!map.texture.id) {
+			map.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
+		}
+
+		fgr::RenderTarget fbo = map.texture.createFrameBuffer();
+		fbo.clear(glm::vec4(0.), false);
+
+		// Every primitive of the orbital goes into one buffer texture, as origin and exponent, powers and coefficient.
+		std::vector<glm::vec4> texels;
+		int ao_count = glm::min(mo.lcao_coefficients.size(), basis.size());
+
+		// Shaders evaluate every primitive everywhere, so screening can only drop primitives whose largest value is below their share of the tolerance.
+		uint total_primitives = 0;
+		for (int i = 0; i < ao_count; ++i) total_primitives += basis[i].gto_primitives.size() + basis[i].sto_primitives.size();
+		const double limit = settings.cubemap_tolerance / glm::max(total_primitives, 1u);
+
+		for (int i = 0; i < ao_count; ++i) {
+			const ContractedBasis& b = basis[i];
+			double coeff = mo.lcao_coefficients[i];
+
+			if (mo.use_stos) {
+				for (STO sto : b.sto_primitives) {
+					if (limit > 0.0 && boundPeak({ RadialBound{ std::abs(sto.coeff * coeff), sto.e_r + sto.e_x + sto.e_y + sto.e_z, 2.0 * sto.alpha, 1 } }) < limit) continue;
+					texels.push_back(glm::vec4(glm::vec3(b.origin), sto.alpha));
+					texels.push_back(glm::vec4(sto.e_x, sto.e_y, sto.e_z, sto.e_r));
+					texels.push_back(glm::vec4(sto.coeff * coeff, 0.f, 0.f, 0.f));
 				}
 			}
 			else {
-				for (int i = 0; i < ao_count; ++i) {
-					ContractedBasis& b = (*basis)[i];
-					double coeff = lcao_coefficients[i];
-
-					for (GTO gto : b.gto_primitives) {
-						exponents3[index] = glm::vec3(gto.e_x, gto.e_y, gto.e_z);
-						alpha[index] = gto.e_r;
-						coeffs[index] = gto.coeff * coeff;
-						origins[index] = b.origin;
-						++index;
+				for (GTO gto : b.gto_primitives) {
+					if (limit > 0.0 && boundPeak({ RadialBound{ std::abs(gto.coeff * coeff), gto.e_x + gto.e_y + gto.e_z, gto.e_r, 2 } }) < limit) continue;
+					texels.push_back(glm::vec4(glm::vec3(b.origin), gto.e_r));
+					texels.push_back(glm::vec4(gto.e_x, gto.e_y, gto.e_z, 0.f));
+					texels.push_back(glm::vec4(gto.coeff * coeff, 0.f, 0.f, 0.f));
+				}
+			}
+		}
 
-						if (index == primitive_count) {
-							index = 0;
+		fgr::Shader& shader = mo.use_stos ? sto_shader : gto_shader;
+		primitive_texture.setData(texels.data(), texels.size());
+		primitive_texture.bindToUnit(fgr::TextureUnit::texture1);
+		shader.setInt(3, fgr::TextureUnit::texture1);
 
-							setGTOUniforms(origins, exponents3, alpha, coeffs, primitive_count);
+		// The cubemap is cleared, so all chunks are simply added up. Draws are issued without waiting in between, only the end is waited for.
+		fgr::setBlending(fgr::Blending::additive);
+		fgr::setDepthTesting(false);
 
-							if (print_progress) flo::printProgress((float)(i + 1) / (float)(ao_count));
+		constexpr int chunk_primitives = 256;
+		const int primitive_count = texels.size() / 3;
+		for (int first = 0; first < primitive_count; first += chunk_primitives) {
+			shader.setInt(4, first);
+			shader.setInt(5, glm::min(chunk_primitives, primitive_count - first));
+			drawSlicesToFBO(vas, fbo, shader);
 
-							drawSlicesToFBO(vas, fbo, gto_shader, gto_compute, map);
+			if (print_progress) flo::printProgress((float)glm::min(first + chunk_primitives, primitive_count) / (float)primitive_count);
+		}
 
-							fgr::setBlending(fgr::Blending::additive);
-						}
-					}
-				}
+		fgr::setBlending(fgr::Blending::linear);
+	}
+#endif
 
-				if (index) {
-					for (int i = index; i < primitive_count; ++i) {
-						origins[i] = glm::vec3(0.0);
-						exponents3[i] = glm::vec3(0.0);
-						alpha[i] = 0.f;
-						coeffs[i] = 0.f;
-					}
+	void MolecularOrbital::writeCubeMap(CubeMap& map, bool print_progress) {
+		if (!basis) return;
+		if (!basis->size()) return;
 
-					setGTOUniforms(origins, exponents3, alpha, coeffs, primitive_count);
+		const CubeFrame frame = fitCubeFrame(map, *basis, shells, &lcao_coefficients);
+		map.bricks.setChannels(settings.cubemap_gradients && !settings.cubemap_use_gpu ? 4 : 1);
 
-					drawSlicesToFBO(vas, fbo, gto_shader, gto_compute, map);
-				}
+		if (settings.cubemap_use_gpu) {
+#if USE_COMPUTE_SHADERS
+			loadShader(use_stos);
+			if (settings.cubemap_hybrid) {
+				if (print_progress) std::cout << "Using compute shaders and " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for rendering\nProgress:\n";
+
+				// The evaluator is built once, the CPU side only walks the layers of tiles it takes.
+				const GridEvaluator evaluator = orbitalEvaluator(lcao_coefficients, map, *frame.basis, frame.shells, evaluationSettings());
+				const TileFunction cpu = [&evaluator](CubeMap& map, const std::vector<uint>& tiles, const std::atomic<bool>* cancel) {
+					writeOrbitalTiles(evaluator, map, tiles, cancel);
+				};
+				writeOrbitalCompute(lcao_coefficients, map, *frame.basis, use_stos, print_progress, &cpu);
 			}
+			else {
+				if (print_progress) std::cout << "Using compute shaders for rendering\nProgress:\n";
 
-			fgr::setBlending(fgr::Blending::linear);
+				writeOrbitalCompute(lcao_coefficients, map, *frame.basis, use_stos, print_progress);
+			}
+#else
+			if (print_progress) std::cout << "Using geometry shaders for rendering\nProgress\n";
 
-			map.texture.loadFromID(map.texture.id);
+			drawOrbital(*this, map, *frame.basis, print_progress);
+			map.invalidate();
+#endif
 			
 			if (print_progress) std::cout << '\n';
 		}
-		else {
-			const uint thread_count = settings.cubemap_slice_count;
+		else if (settings.cubemap_cache_aos) {
+			if (print_progress) std::cout << "Using " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for rendering\n";
 
-			if (print_progress) std::cout << "Using " << thread_count << " CPU thread(s) for rendering\nProgress:\n";
+			updateAOCache(map, *frame.basis, frame.shells, print_progress);
+			ao_cache.writeOrbitals(std::vector<const std::vector<double>*>{ &lcao_coefficients }, std::vector<CubeMap*>{ &map });
+			if (print_progress) std::cout << "Cubemap uses " << map.bricks.allocatedCount() << " of " << map.bricks.bricks.size() << " bricks (" << map.bricks.memory() / (1024 * 1024) << " MB)\n";
+			map.upload();
+		}
+		else {
+			if (print_progress) std::cout << "Using " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for rendering\nProgress:\n";
 
-			for (int z = 0; z < dimensions.z; ++z) {
-				for (int y = 0; y < dimensions.y; ++y) {
-					for (int x = 0; x < dimensions.x; ++x) {
-						map.texture.data[4 * (x + dimensions.x * (y + dimensions.y * z))] = 0.0;
-						map.texture.data[4 * (x + dimensions.x * (y + dimensions.y * z)) + 1] = 0.0;
-						map.texture.data[4 * (x + dimensions.x * (y + dimensions.y * z)) + 2] = 0.0;
-						map.texture.data[4 * (x + dimensions.x * (y + dimensions.y * z)) + 3] = 0.0;
-					}
-				}
+			GridEvaluator evaluator(map, *frame.basis, frame.shells, lcao_coefficients, settings.cubemap_separable, false, settings.cubemap_tolerance);
+			evaluator.single_precision = settings.cubemap_single_precision;
+			if (print_progress && settings.cubemap_tolerance > 0.f) {
+				std::cout << "Screening kept " << evaluator.kept << " of " << evaluator.kept + evaluator.dropped << " basis function groups, error below " << settings.cubemap_tolerance << '\n';
 			}
+			const TileGrid& grid = evaluator.grid;
 
-			std::vector<std::unique_ptr<std::thread>> threads(thread_count - 1);
+			// Only the tiles on the lower side of the mirror planes are evaluated, the rest are their mirror images.
+			const Symmetry symmetry = orbitalSymmetry(frame, lcao_coefficients);
+			const std::vector<uint> tiles = symmetryTiles(map, symmetry);
 
-			for (int i = 0; i < thread_count - 1; ++i) {
-				uint min = map.texture.depth * i / thread_count;
-				uint max = map.texture.depth * (i + 1) / thread_count;
-				threads[i] = std::make_unique<std::thread>(&MolecularOrbital::threadWriteCubeSlice, this, &map, min, max);
-			}
+			// Progress is only printed from the calling thread, which works on tiles like any other.
+			const std::thread::id caller = std::this_thread::get_id();
+			std::atomic<uint> finished = 0;
 
-			writeCubeSlice(map, map.texture.depth * (thread_count - 1) / thread_count, map.texture.depth, true);
+			forEachTile(tiles.size(), [&](uint i) {
+				std::vector<uint> list;
+				evaluator.listFunctions(grid.tileMin(tiles[i]), grid.tileMax(tiles[i]), list);
+				evaluator.evaluateTile(tiles[i], list, map.bricks);
 
-			if (print_progress) std::cout << "\nThread 1 finished\n";
+				const uint done = ++finished;
+				if (print_progress && done % grid.tile_count.x == 0 && std::this_thread::get_id() == caller) flo::printProgress((float)done / (float)tiles.size());
+			});
+			mirrorBricks(map.bricks, symmetry);
 
-			for (int i = 0; i < thread_count - 1; ++i) {
-				threads[i]->join();
-				if (print_progress) std::cout << "Thread " << i + 2 << " finished\n";
-			}
+			if (print_progress) std::cout << '\n';
+			if (print_progress && symmetry.mirrors) std::cout << "Symmetry left " << tiles.size() << " of " << grid.size() << " tiles to evaluate\n";
 
-			if (!map.texture.id) {
-				map.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
-			}
-			else {
-				map.texture.syncTexture();
-			}
+			if (print_progress) std::cout << "Cubemap uses " << map.bricks.allocatedCount() << " of " << map.bricks.bricks.size() << " bricks (" << map.bricks.memory() / (1024 * 1024) << " MB)\n";
+			map.upload();
 		}
 	}
 
 	void resizeCubeMap(uint x, uint y, uint z) {
+		cancelRefinement();
 		if (!x && !y && !z) {
 			resize_cubemap = true;
 			return;
 		}
 		cubemap.resize(glm::ivec3(x, y, z));
 		resize_cubemap = false;
+		density_record.valid = false;
+	}
+
+	bool refineCubeMap(bool wait) {
+		return refinement.poll(cubemap, wait);
+	}
+
+	void cancelRefinement() {
+		if (refinement.active()) density_record.valid = false;
+		refinement.cancel(cubemap);
 	}
 
 	void MOCubeMap(uint orbital) {
 		if (orbital >= mos.size()) return;
-		mos[orbital].writeCubeMap(cubemap);
+		cancelRefinement();
+		density_record.valid = false;
+
+		MolecularOrbital& mo = mos[orbital];
+		if (settings.cubemap_progressive && !settings.cubemap_use_gpu && mo.basis && mo.basis->size()) {
+			std::cout << "Using " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for rendering\n";
+
+			const CubeFrame frame = fitCubeFrame(cubemap, *mo.basis, mo.shells, &mo.lcao_coefficients);
+			cubemap.bricks.setChannels(settings.cubemap_gradients ? 4 : 1);
+			const std::vector<ContractedBasis>* basis = frame.basis;
+			const std::vector<Shell>* shells = frame.shells;
+			const std::vector<double> coefficients = mo.lcao_coefficients;
+			const EvaluationSettings options = evaluationSettings();
+			refinement.begin(cubemap, [basis, shells, coefficients, options](CubeMap& map, const std::vector<uint>& tiles, const std::atomic<bool>* cancel) {
+				writeOrbitalTiles(coefficients, map, *basis, shells, tiles, options, cancel);
+			}, settings.cubemap_refine_tolerance);
+			return;
+		}
+
+		mo.writeCubeMap(cubemap);
 	}
 
-	void densityCubeMapMO() {
-		CubeMap psi_map;
-		uint size = 0;
-		if (!resize_cubemap) psi_map.resize(glm::ivec3(cubemap.texture.width, cubemap.texture.height, cubemap.texture.depth));
-		else fitCubeMap(psi_map, basis_set);
-		cubemap.resize(glm::ivec3(psi_map.texture.width, psi_map.texture.height, psi_map.texture.depth));
-		size = psi_map.texture.width * psi_map.texture.height * psi_map.texture.depth;
+	void fitExportMap(CubeMap& map, glm::ivec3 resolution) {
+		if (!basis_set.size()) return;
 
-		bool inited = false;
+		fitCubeMap(map, basis_set);
+		if (resolution == glm::ivec3(0)) resolution = glm::ivec3((glm::vec3)map.size * settings.cubemap_density);
+		map.resize(resolution);
+	}
 
-		std::vector<fgr::VertexArray> vas;
-		fgr::RenderTarget fbo;
-		if (settings.cubemap_use_gpu) {
-#if USE_COMPUTE_SHADERS
-			std::cout << "Using compute shaders for rendering\n";
-			if (!density_compute.loaded) {
-				density_compute = fgr::ComputeShader("shaders/volumol/density.comp", std::vector<std::string>{"occupation"});
-				density_compute.compile();
-				density_compute.work_group_count = glm::uvec3((glm::ivec3(cubemap.texture.width, cubemap.texture.height, cubemap.texture.depth) + 3) / 4);
+	void writeMOCubeMaps(const std::vector<uint>& orbitals, const std::vector<CubeMap*>& maps) {
+		if (maps.size() != orbitals.size()) {
+			std::cout << "Expected one cubemap per orbital\n";
+			return;
+		}
+
+		std::vector<const std::vector<double>*> coefficients;
+		for (uint orbital : orbitals) {
+			if (orbital >= mos.size()) {
+				std::cout << "There is no orbital " << orbital << '\n';
+				return;
 			}
-#else
-			std::cout << "Using geometry shaders for rendering\n";
-			if (!density_shader.loaded) {
-				density_shader = fgr::Shader("shaders/volumol/density.vert", "shaders/volumol/density.frag", "shaders/volumol/density.geom", std::vector<std::string>{"layer_count", "orbital", "occupation"});
-				density_shader.compile();
+			coefficients.push_back(&mos[orbital].lcao_coefficients);
+		}
+		if (!coefficients.size()) return;
+
+		// Orbitals of one file share their basis.
+		const MolecularOrbital& mo = mos[orbitals[0]];
+		if (!mo.basis || !mo.basis->size()) return;
+
+		for (CubeMap* map : maps) map->bricks.setChannels(1);
+		std::cout << "Using " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for " << orbitals.size() << " orbitals\n";
+
+		if (settings.cubemap_cache_aos) {
+			updateAOCache(*maps[0], *mo.basis, mo.shells, true);
+			ao_cache.writeOrbitals(coefficients, maps);
+		}
+		else writeOrbitals(coefficients, maps, *mo.basis, mo.shells);
+	}
+
+	DensityChannel densityChannel() {
+		return (DensityChannel)glm::min(settings.density_channel, 3u);
+	}
+
+	// Orders points along a Morton curve, so that consecutive points lie close to each other.
+	std::vector<uint> mortonOrder(const std::vector<glm::dvec3>& points) {
+		glm::dvec3 min = points[0], max = points[0];
+		for (const glm::dvec3& p : points) {
+			min = glm::min(min, p);
+			max = glm::max(max, p);
+		}
+		const glm::dvec3 scale = 1023.0 / glm::max(max - min, glm::dvec3(1e-6));
+
+		std::vector<std::pair<uint, uint>> keys(points.size());
+		for (uint i = 0; i < points.size(); ++i) {
+			const glm::uvec3 cell = glm::uvec3((points[i] - min) * scale);
+			uint key = 0;
+			for (int bit = 0; bit < 10; ++bit) {
+				for (int a = 0; a < 3; ++a) key |= ((cell[a] >> bit) & 1u) << (3 * bit + a);
 			}
+			keys[i] = std::make_pair(key, i);
+		}
+		std::sort(keys.begin(), keys.end());
 
-			density_shader.setInt(0, cubemap.texture.depth);
-			density_shader.setInt(1, fgr::TextureUnit::texture0);
+		std::vector<uint> order(points.size());
+		for (uint i = 0; i < points.size(); ++i) order[i] = keys[i].second;
+		return order;
+	}
 
-			generateSliceVertexArrays(vas, cubemap.texture.depth);
-#endif
+	template<typename T>
+	void evaluatePointBlock(const GridEvaluator& evaluator, const glm::dvec3* points, std::vector<uint>& functions, std::vector<float>& values) {
+		glm::dvec3 min = points[0], max = points[0];
+		for (int i = 1; i < tile_voxels; ++i) {
+			min = glm::min(min, points[i]);
+			max = glm::max(max, points[i]);
+		}
 
-			if (!cubemap.texture.id) cubemap.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
-			fbo = cubemap.texture.createFrameBuffer();
-			fbo.clear(glm::vec4(0.), false);
+		std::vector<uint> list;
+		std::vector<T> block_values;
+		evaluator.listFunctions(min, max, list);
+		evaluator.evaluatePointFunctions(points, list, functions, block_values);
+		values.assign(block_values.begin(), block_values.end());
+	}
+
+	void evaluatePoints(const std::vector<uint>& orbitals, bool density, bool gradients, const std::vector<glm::dvec3>& points, float* out) {
+		const uint fields = orbitals.size() + (density ? 1 : 0);
+		const uint planes = gradients ? 4 : 1;
+		std::fill(out, out + points.size() * fields * planes, 0.f);
+		if (!basis_set.size() || !fields || !points.size()) return;
+
+		std::vector<const std::vector<double>*> coefficients;
+		for (uint orbital : orbitals) {
+			if (orbital >= mos.size()) {
+				std::cout << "There is no orbital " << orbital << '\n';
+				return;
+			}
+			coefficients.push_back(&mos[orbital].lcao_coefficients);
+		}
+
+		const DensityMatrix matrix = density ? DensityMatrix(mos, basis_set.size(), densityChannel()) : DensityMatrix();
+		std::vector<double> weights(basis_set.size(), 0.0);
+		if (density && settings.cubemap_tolerance > 0.f) weights = screeningWeights(matrix, basis_set);
+		for (const std::vector<double>* c : coefficients) {
+			for (uint i = 0; i < weights.size() && i < c->size(); ++i) weights[i] = glm::max(weights[i], std::abs((*c)[i]));
+		}
+
+		// The evaluator does not use a grid, the map only tells it whether to evaluate gradients.
+		CubeMap layout;
+		layout.bricks.setChannels(planes);
+		const GridEvaluator evaluator(layout, basis_set, &shells, std::vector<double>(basis_set.size(), 1.0), false, true, settings.cubemap_tolerance, &weights);
+
+		const std::vector<uint> order = mortonOrder(points);
+		const uint blocks = (points.size() + tile_voxels - 1) / tile_voxels;
+		forEachTile(blocks, [&](uint block) {
+			// The last block is filled up with its last point.
+			const uint first = block * tile_voxels;
+			const uint count = glm::min((uint)points.size() - first, (uint)tile_voxels);
+			std::vector<glm::dvec3> block_points(tile_voxels);
+			for (int i = 0; i < tile_voxels; ++i) block_points[i] = points[order[first + glm::min((uint)i, count - 1)]];
+
+			std::vector<uint> functions;
+			std::vector<float> values;
+			if (settings.cubemap_single_precision) evaluatePointBlock<float>(evaluator, block_points.data(), functions, values);
+			else evaluatePointBlock<double>(evaluator, block_points.data(), functions, values);
+
+			std::vector<float> results(fields * planes * tile_voxels, 0.f);
+			if (coefficients.size()) combineFunctions(functions, values.data(), planes, coefficients, 0, coefficients.size(), results.data());
+			if (density) {
+				float* rho = results.data() + orbitals.size() * planes * tile_voxels;
+				addTileDensity(matrix, functions, values.data(), settings.cubemap_tolerance, rho, gradients ? rho + tile_voxels : nullptr);
+			}
+
+			for (uint i = 0; i < count; ++i) {
+				float* point = out + order[first + i] * fields * planes;
+				for (uint f = 0; f < fields; ++f) {
+					for (uint c = 0; c < planes; ++c) point[f * planes + c] = results[(f * planes + c) * tile_voxels + i];
+				}
+			}
+		});
+	}
+
+	// Dimensions of the cubemap once a progressive cubemap is complete.
+	glm::ivec3 finalDimensions() {
+		if (refinement.active()) return refinement.dimensions;
+		return glm::ivec3(cubemap.texture.width, cubemap.texture.height, cubemap.texture.depth);
+	}
+
+	void recordDensity(bool spin_maps) {
+		density_record.valid = true;
+		density_record.channel = densityChannel();
+		density_record.spin_maps = spin_maps;
+		density_record.dimensions = finalDimensions();
+		density_record.origin = cubemap.origin;
+		density_record.size = cubemap.size;
+		density_record.axes = cubemap.axes;
+		density_record.channels = cubemap.bricks.channels;
+		density_record.occupations.resize(mos.size());
+		for (uint i = 0; i < mos.size(); ++i) density_record.occupations[i] = mos[i].occupation;
+	}
+
+	// Orbitals whose occupation changed since the last density, with the change of their share in channel as occupation.
+	std::vector<MolecularOrbital> occupationChanges(DensityChannel channel) {
+		std::vector<MolecularOrbital> changes;
+		for (uint i = 0; i < mos.size(); ++i) {
+			if (mos[i].occupation == density_record.occupations[i]) continue;
+			MolecularOrbital previous = mos[i];
+			previous.occupation = density_record.occupations[i];
+			changes.push_back(mos[i]);
+			changes.back().occupation = channelOccupation(mos[i], channel) - channelOccupation(previous, channel);
 		}
-		else std::cout << "Using " << settings.cubemap_slice_count << " CPU thread(s) for rendering\n";
+		return changes;
+	}
+
+	// Adds the density of the orbitals whose occupation changed since the last density to the cubemap. If the total and spin density are kept,
+	// they are updated and the channel is composed from them, which is all that needs to be done if only the channel changed.
+	// Returns false if the cubemap has to be written from scratch instead.
+	bool updateDensity() {
+		if (settings.cubemap_use_gpu || !density_record.valid || !basis_set.size() || density_record.occupations.size() != mos.size()) return false;
+
+		CubeMap target(finalDimensions());
+		const CubeFrame frame = fitCubeFrame(target, basis_set, &shells, nullptr);
+		if (target.bricks.dimensions != density_record.dimensions || target.origin != density_record.origin || target.size != density_record.size ||
+			target.axes != density_record.axes || density_record.channels != (settings.cubemap_gradients ? 4 : 1)) return false;
 
-		std::cout << "Progress:\n";
+		const DensityChannel channel = densityChannel();
+		const bool spin_maps = density_record.spin_maps;
+		if (!spin_maps && channel != density_record.channel) return false;
 
+		// Adding the difference only pays off if fewer orbitals changed than are occupied.
+		const std::vector<MolecularOrbital> changes = occupationChanges(spin_maps ? DensityChannel::total : channel);
 		uint occupied_count = 0;
-		for (MolecularOrbital& mo : mos) {
-			if (mo.occupation < 0.001 && mo.occupation > -0.001) continue;
-			++occupied_count;
+		for (const MolecularOrbital& mo : mos) {
+			if (mo.occupation >= 0.001 || mo.occupation <= -0.001) ++occupied_count;
 		}
+		if ((!changes.size() && !spin_maps) || (changes.size() && changes.size() >= occupied_count)) return false;
 
-		uint current_progress = 0;
-		for (MolecularOrbital& mo : mos) {
-			if (mo.occupation < 0.001 && mo.occupation > -0.001) continue;
-			++current_progress;
+		refinement.poll(cubemap, true);
 
-			float occuption = mo.occupation;
+		if (changes.size()) {
+			std::cout << "Updating the density for " << changes.size() << " orbital(s) on " << flo::ThreadPool::global().threadCount() << " CPU thread(s)\n";
+			DensityMatrix difference(changes, basis_set.size());
+			if (settings.cubemap_cache_aos) updateAOCache(cubemap, *frame.basis, frame.shells, true);
 
-			flo::printProgress((float)current_progress / (float)occupied_count);
+			if (spin_maps) {
+				DensityMatrix spin_difference(occupationChanges(DensityChannel::spin), basis_set.size());
+				if (settings.cubemap_cache_aos) ao_cache.writeSpinDensity(difference, spin_difference, density_total, density_spin, true);
+				else writeSpinDensity(difference, spin_difference, cubemap, density_total, density_spin, *frame.basis, frame.shells, nullptr, true);
+			}
+			else if (settings.cubemap_cache_aos) ao_cache.writeDensity(difference, cubemap, true);
+			else writeDensity(difference, cubemap, *frame.basis, frame.shells, nullptr, true);
+		}
+		if (spin_maps) composeDensity(density_total, density_spin, channel, cubemap.bricks);
 
-			mo.writeCubeMap(psi_map, false);
+		cubemap.upload();
+		recordDensity(spin_maps);
+		return true;
+	}
 
-			if (!inited) {
-				cubemap.origin = psi_map.origin;
-				cubemap.size = psi_map.size;
-				if (!settings.cubemap_use_gpu) {
-					for (int i = 0; i < 4 * size; ++i) {
-						cubemap.texture.data[i] = 0.f;
-					}
-				}
-				inited = true;
+	void densityCubeMapMO() {
+		if (updateDensity()) return;
+		cancelRefinement();
+		density_record.valid = false;
+		density_total.clear();
+		density_spin.clear();
+
+		const DensityChannel channel = densityChannel();
+		if (!settings.cubemap_use_gpu) {
+			if (!basis_set.size()) return;
+
+			std::cout << "Using " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for rendering\n";
+
+			const CubeFrame frame = fitCubeFrame(cubemap, basis_set, &shells, nullptr);
+			cubemap.bricks.setChannels(settings.cubemap_gradients ? 4 : 1);
+
+			// Previews evaluate the channel alone.
+			if (settings.cubemap_progressive) {
+				DensityMatrix density(mos, basis_set.size(), channel);
+				const EvaluationSettings options = evaluationSettings();
+				refinement.begin(cubemap, [density, frame, options](CubeMap& map, const std::vector<uint>& tiles, const std::atomic<bool>* cancel) {
+					writeDensity(density, map, *frame.basis, frame.shells, &tiles, false, options, cancel);
+				}, settings.cubemap_refine_tolerance);
+				recordDensity(false);
+				return;
 			}
 
-			if (settings.cubemap_use_gpu) {
-				fgr::setBlending(fgr::Blending::additive);
-				psi_map.texture.bindToUnit(fgr::TextureUnit::texture0);
-#if USE_COMPUTE_SHADERS
-				density_compute.setFloat(0, mo.occupation);
-				density_compute.bindImage(1, psi_map.texture.id, false, true, true, GL_RGBA16F);
-#else
-				density_shader.setFloat(2, mo.occupation);
-#endif
-				drawSlicesToFBO(vas, fbo, density_shader, density_compute, cubemap);
-				fgr::setBlending(fgr::Blending::linear);
+			if (settings.cubemap_cache_aos) updateAOCache(cubemap, *frame.basis, frame.shells, true);
+
+			DensityMatrix density(mos, basis_set.size());
+			if (channel == DensityChannel::total) {
+				if (settings.cubemap_cache_aos) ao_cache.writeDensity(density, cubemap);
+				else {
+					const Symmetry symmetry = densitySymmetry(frame, DensityChannel::total);
+					const std::vector<uint> tiles = symmetryTiles(cubemap, symmetry);
+					writeDensity(density, cubemap, *frame.basis, frame.shells, &tiles);
+					mirrorBricks(cubemap.bricks, symmetry);
+				}
 			}
 			else {
-				flo::setConsoleProgress((float)current_progress / (float)occupied_count);
-				for (int i = 0; i < size; ++i) {
-					float& psi = psi_map.texture.data[4 * i];
-					cubemap.texture.data[4 * i] += occuption * psi * psi;
+				// Any other channel keeps the total and spin density, so that switching between channels does not evaluate anything.
+				DensityMatrix spin(mos, basis_set.size(), DensityChannel::spin);
+				for (BrickMap* bricks : { &density_total, &density_spin }) {
+					bricks->resize(cubemap.bricks.dimensions);
+					bricks->setChannels(cubemap.bricks.channels);
+				}
+				if (settings.cubemap_cache_aos) ao_cache.writeSpinDensity(density, spin, density_total, density_spin);
+				else {
+					// Both densities are evaluated on the same tiles, so only the planes that both follow are used.
+					Symmetry total_symmetry = densitySymmetry(frame, DensityChannel::total);
+					Symmetry spin_symmetry = densitySymmetry(frame, DensityChannel::spin);
+					total_symmetry.mirrors &= spin_symmetry.mirrors;
+					spin_symmetry.mirrors = total_symmetry.mirrors;
+					const std::vector<uint> tiles = symmetryTiles(cubemap, total_symmetry);
+					writeSpinDensity(density, spin, cubemap, density_total, density_spin, *frame.basis, frame.shells, &tiles);
+					mirrorBricks(density_total, total_symmetry);
+					mirrorBricks(density_spin, spin_symmetry);
 				}
+				composeDensity(density_total, density_spin, channel, cubemap.bricks);
 			}
+
+			cubemap.upload();
+			recordDensity(channel != DensityChannel::total);
+			return;
 		}
-		if (settings.cubemap_use_gpu) {
-			cubemap.texture.loadFromID(cubemap.texture.id);
+
+		if (!basis_set.size()) return;
+
+		// The orbitals that take part in the channel.
+		std::vector<const MolecularOrbital*> orbitals;
+		std::vector<double> occupations;
+		for (MolecularOrbital& mo : mos) {
+			const double occupation = channelOccupation(mo, channel);
+			if (occupation < 0.001 && occupation > -0.001) continue;
+			orbitals.push_back(&mo);
+			occupations.push_back(occupation);
+		}
+
+#if USE_COMPUTE_SHADERS
+		const CubeFrame frame = fitCubeFrame(cubemap, basis_set, &shells, nullptr);
+		if (settings.cubemap_hybrid) {
+			std::cout << "Using compute shaders and " << flo::ThreadPool::global().threadCount() << " CPU thread(s) for rendering\nProgress:\n";
+
+			// The evaluator and its screening are built once, for the single channel that the GPU writes as well.
+			const DensityMatrix density(mos, basis_set.size(), channel);
+			const std::vector<const DensityMatrix*> densities = { &density };
+			const EvaluationSettings options = evaluationSettings();
+			cubemap.bricks.setChannels(1);
+			const GridEvaluator evaluator = densityEvaluator(densities, cubemap, *frame.basis, frame.shells, options);
+			const TileFunction cpu = [&evaluator, &densities, options](CubeMap& map, const std::vector<uint>& tiles, const std::atomic<bool>* cancel) {
+				writeDensityTiles(evaluator, densities, { &map.bricks }, &tiles, false, options, cancel);
+			};
+			writeDensityCompute(orbitals, occupations, cubemap, *frame.basis, mos.size() && mos[0].use_stos, &cpu);
 		}
 		else {
-			cubemap.texture.syncTexture();
+			std::cout << "Using compute shaders for rendering\nProgress:\n";
+
+			writeDensityCompute(orbitals, occupations, cubemap, *frame.basis, mos.size() && mos[0].use_stos);
+		}
+#else
+		std::cout << "Using geometry shaders for rendering\nProgress:\n";
+
+		CubeMap psi_map;
+		if (!resize_cubemap) psi_map.resize(glm::ivec3(cubemap.texture.width, cubemap.texture.height, cubemap.texture.depth));
+		const CubeFrame frame = fitCubeFrame(psi_map, basis_set, &shells, nullptr);
+		cubemap.resize(glm::ivec3(psi_map.texture.width, psi_map.texture.height, psi_map.texture.depth));
+		cubemap.origin = psi_map.origin;
+		cubemap.size = psi_map.size;
+		cubemap.axes = psi_map.axes;
+
+		if (!density_shader.loaded) {
+			density_shader = fgr::Shader("shaders/volumol/density.vert", "shaders/volumol/density.frag", "shaders/volumol/density.geom", std::vector<std::string>{"layer_count", "orbital", "occupation"});
+			density_shader.compile();
 		}
+
+		density_shader.setInt(0, cubemap.texture.depth);
+		density_shader.setInt(1, fgr::TextureUnit::texture0);
+
+		std::vector<fgr::VertexArray> vas;
+		generateSliceVertexArrays(vas, cubemap.texture.depth);
+
+		if (!cubemap.texture.id) cubemap.texture.createBuffer(GL_CLAMP_TO_BORDER, GL_LINEAR);
+		fgr::RenderTarget fbo = cubemap.texture.createFrameBuffer();
+		fbo.clear(glm::vec4(0.), false);
+
+		// Each orbital stays in the texture of psi_map and is added from there, only the density is read back at the end.
+		for (uint i = 0; i < orbitals.size(); ++i) {
+			flo::printProgress((float)(i + 1) / (float)orbitals.size());
+
+			drawOrbital(*orbitals[i], psi_map, *frame.basis, false);
+
+			fgr::setBlending(fgr::Blending::additive);
+			psi_map.texture.bindToUnit(fgr::TextureUnit::texture0);
+			density_shader.setFloat(2, occupations[i]);
+			drawSlicesToFBO(vas, fbo, density_shader);
+			fgr::setBlending(fgr::Blending::linear);
+		}
+		cubemap.invalidate();
+#endif
 		flo::setConsoleProgress(0.f);
 		std::cout << '\n';
 	}
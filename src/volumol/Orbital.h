@@ -3,6 +3,8 @@
 #include <vector>
 
 #include "../graphics/3D/Texture3D.h"
+#include "../graphics/PixelBuffer.h"
+#include "BrickMap.h"
 
 namespace mol {
 	struct GTO {
@@ -29,17 +31,36 @@ namespace mol {
 		double phi(const glm::dvec3& pos);
 	};
 	
+	// The values live in bricks on the CPU, texture only holds the dimensions and the OpenGL texture.
+	// Maps written on the GPU only exist in the texture until download() is called, the bricks are stale until then.
 	struct CubeMap {
 		fgr::TextureHandle3D texture;
+		BrickMap bricks;
+		// origin and size are given along axes, whose columns are the directions of the grid axes. A point p of the grid lies at axes * p.
 		glm::dvec3 origin;
 		glm::dvec3 size;
+		glm::dmat3 axes = glm::dmat3(1.0);
+		bool stale = false;
+		fgr::PixelBuffer readback;
 
-		CubeMap() = default;
+		CubeMap();
 
 		CubeMap(glm::ivec3 resolution);
 
 		void resize(glm::ivec3 resolution);
 
+		// Copies the bricks to the OpenGL texture, creating it if necessary.
+		void upload();
+
+		// Marks the bricks stale after the texture was written on the GPU and releases them.
+		void invalidate();
+
+		// Starts copying a stale texture into readback without waiting for it, unless a copy was already started when the map was written.
+		void prefetch();
+
+		// Copies a stale texture back into the bricks, waiting for the copy started by prefetch() if there is one.
+		void download();
+
 		float sample(glm::ivec3 coord);
 
 		glm::vec3 sampleGradient(glm::ivec3 coord);
@@ -50,9 +71,35 @@ namespace mol {
 		std::vector<STO> sto_primitives;
 		glm::dvec3 origin = glm::dvec3(0.0);
 
-		double sample(glm::dvec3 r);
+		double sample(glm::dvec3 r) const;
 	};
 
+	struct ShellTerm {
+		int e_x, e_y, e_z;
+		double weight;
+	};
+
+	// Basis functions on one center that share the contracted radial part sum_i c_i exp(-a_i r^2).
+	// Every component is a polynomial in x, y and z, component i is the basis function first_function + i.
+	struct Shell {
+		glm::dvec3 origin = glm::dvec3(0.0);
+		int l = 0;
+		bool spherical = false;
+		// Exponents and contraction coefficients, the latter include the radial part of the normalization.
+		std::vector<glm::dvec2> primitives;
+		std::vector<std::vector<ShellTerm>> components;
+		uint first_function = 0;
+
+		double radial(double r2) const;
+	};
+
+	// The part of the GTO normalization that only depends on exponent and l, the remaining factor is part of the angular terms.
+	double radialNormalization(double exponent, int l);
+
+	std::vector<ShellTerm> sphericalShellTerms(int l, int m);
+
+	std::vector<ShellTerm> cartesianShellTerms(int x, int y, int z);
+
 	std::vector<GTO> generateSphericalGTO(double exponent, int l, int m);
 
 	GTO generateCartesianGTO(double exponent, int x, int y, int z);
@@ -66,6 +113,7 @@ namespace mol {
 
 	struct MolecularOrbital {
 		std::vector<ContractedBasis>* basis = nullptr;
+		std::vector<Shell>* shells = nullptr;
 		bool use_stos = false;
 		std::vector<double> lcao_coefficients;
 		double energy = 0.0;
@@ -76,19 +124,38 @@ namespace mol {
 		MolecularOrbital() = default;
 
 		void writeCubeMap(CubeMap& cubemap, bool print_progress = true);
-
-	private:
-		static void threadWriteCubeSlice(MolecularOrbital* mo, CubeMap* cubemap, uint z_min, uint z_max);
-
-		void writeCubeSlice(CubeMap& cubemap, uint z_min, uint z_max, bool print_progess = false) const;
 	};
 
 	void resizeCubeMap(uint x, uint y, uint z);
 
+	// Drops the basis function cache and the record of the last density, needs to be called whenever the basis set changes.
+	void clearAOCache();
+
 	void MOCubeMap(uint orbital);
 
+	// Moves the levels of a progressive cubemap that have finished into the cubemap. If wait is set, the cubemap is completed first.
+	// Returns true if the cubemap changed.
+	bool refineCubeMap(bool wait = false);
+
+	// Stops a progressive cubemap, the cubemap is left empty at its full resolution.
+	void cancelRefinement();
+
+	// Writes the electron density into the cubemap. If only the occupations of a few orbitals changed since the last density on the CPU
+	// and the grid stayed the same, only the difference in density of those orbitals is added.
 	void densityCubeMapMO();
 
+	// Places map around the loaded molecule like the cubemap. A resolution of zero follows cubemap_density.
+	void fitExportMap(CubeMap& map, glm::ivec3 resolution);
+
+	// Evaluates several orbitals into one map each in a single pass on the CPU, all maps must share the grid of the first.
+	// The basis functions of each tile are evaluated once, or taken from the cache, and shared by all orbitals. The maps are not uploaded.
+	void writeMOCubeMaps(const std::vector<uint>& orbitals, const std::vector<CubeMap*>& maps);
+
+	// Evaluates orbitals and, if density is set, the electron density in the channel of the settings at arbitrary points on the CPU.
+	// For every point, out receives one value per orbital followed by the density, each followed by its x, y and z derivatives if gradients is set.
+	// Points are given in angstrom. Nearby points are evaluated together, tile_voxels at a time, from the basis functions that overlap them.
+	void evaluatePoints(const std::vector<uint>& orbitals, bool density, bool gradients, const std::vector<glm::dvec3>& points, float* out);
+
 	uint findHOMO(Spin spin);
 
 	uint MOcount();
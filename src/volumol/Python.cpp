@@ -4,6 +4,7 @@
 #include "WFXReader.h"
 #include "XYZReader.h"
 #include "CubeReader.h"
+#include "CubeWriter.h"
 #include "Displacements.h"
 #include "SDFReader.h"
 #include "Orbital.h"
@@ -152,6 +153,22 @@ DLLEXPORT void pyDensityCubemap() {
 	mol::densityCubeMapMO();
 }
 
+DLLEXPORT int pyExportMOCubes(int* orbitals, int orbital_count, char const** paths, int path_count, int* resolution, float* origin, float* size) {
+	std::vector<uint> orbital_list(orbitals, orbitals + orbital_count);
+	std::vector<std::string> path_list;
+	for (int i = 0; i < path_count; ++i) {
+		if (!paths[i]) return 0;
+		path_list.push_back(paths[i]);
+	}
+	return mol::Cub::exportMOs(orbital_list, path_list, glm::ivec3(resolution[0], resolution[1], resolution[2]), glm::dvec3(vec3FromFloats(origin, 0)), glm::dvec3(vec3FromFloats(size, 0)));
+}
+
+DLLEXPORT void pyEvaluatePoints(double* points, int point_count, int* orbitals, int orbital_count, bool density, bool gradients, float* out) {
+	std::vector<glm::dvec3> point_list(point_count);
+	for (int i = 0; i < point_count; ++i) point_list[i] = glm::dvec3(points[3 * i], points[3 * i + 1], points[3 * i + 2]);
+	mol::evaluatePoints(std::vector<uint>(orbitals, orbitals + orbital_count), density, gradients, point_list, out);
+}
+
 DLLEXPORT void pySetIsosurface() {
 	mol::Renderer::setIsosurface();
 }
@@ -218,6 +235,8 @@ DLLEXPORT void pyUpdateSettings(float* floats, float* vectors, int* ints, bool*
 	settings.clear_color.a					= floats[20];
 	settings.arrow_thickness				= floats[21];
 	settings.arrow_length_multiplier		= floats[22];
+	settings.cubemap_refine_tolerance		= floats[23];
+	settings.cubemap_tolerance				= glm::max(floats[24], 0.f);
 
 	settings.ambient_color					= vec3FromFloats(vectors, 0);
 	settings.sun_color						= vec3FromFloats(vectors, 1);
@@ -233,6 +252,8 @@ DLLEXPORT void pyUpdateSettings(float* floats, float* vectors, int* ints, bool*
 	settings.taa_quality					= glm::max(ints[4], 1);
 	settings.cubemap_slice_count			= glm::max(ints[5], 1);
 	settings.ao_iterations					= ints[6];
+	settings.thread_count					= glm::max(ints[7], 0);
+	settings.density_channel				= glm::clamp(ints[8], 0, 3);
 
 	settings.smooth_bonds					= bools[0];
 	settings.premulitply_color				= bools[1];
@@ -247,6 +268,14 @@ DLLEXPORT void pyUpdateSettings(float* floats, float* vectors, int* ints, bool*
 	settings.enable_shadows					= bools[10];
 	settings.sticky_sun						= bools[11];
 	settings.black_bonds					= bools[12];
+	settings.cubemap_single_precision		= bools[13];
+	settings.cubemap_separable				= bools[14];
+	settings.cubemap_cache_aos				= bools[15];
+	settings.cubemap_progressive			= bools[16];
+	settings.cubemap_gradients				= bools[17];
+	settings.cubemap_hybrid					= bools[18];
+	settings.cubemap_fit_axes				= bools[19];
+	settings.cubemap_symmetry				= bools[20];
 
 	mol::Renderer::updateSettings(settings);
 }
@@ -0,0 +1,233 @@
+#include "Refinement.h"
+
+#include "GridEvaluator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace mol {
+	// Resolution divisor of the first level, every further level halves it.
+	constexpr int coarse_factor = 4;
+
+	const glm::ivec3 brick_shape = glm::ivec3(tile_width, tile_size, tile_size);
+
+	glm::ivec3 levelDimensions(const glm::ivec3& dimensions, int factor) {
+		return glm::max((dimensions + factor - 1) / factor, glm::ivec3(4));
+	}
+
+	// Position of the voxel centers of a finer grid in voxels of a coarser grid over the same box, clamped to the coarse grid.
+	// scale is the number of coarse voxels per fine voxel along each axis.
+	glm::dvec3 coarsePosition(const glm::ivec3& voxel, const glm::dvec3& scale, const glm::ivec3& coarse_dimensions) {
+		return glm::clamp((glm::dvec3(voxel) + 0.5) * scale - 0.5, glm::dvec3(0.0), glm::dvec3(coarse_dimensions - 1));
+	}
+
+	// Fills one tile of the fine grid by trilinear interpolation of the coarse voxels between min and max, which must cover the tile.
+	// channel 0 interpolates the values, channels 1 to 3 the components of the gradient.
+	void interpolateTile(const BrickMap& coarse, const glm::dvec3& scale, const glm::ivec3& tile_min, const glm::ivec3& tile_extent,
+		const glm::ivec3& min, const glm::ivec3& max, int channel, float* values) {
+		// The coarse voxels are gathered first, so that interpolation does not look up bricks.
+		const glm::ivec3 extent = max - min + 1;
+		std::vector<float> block(extent.x * extent.y * extent.z);
+		for (int z = 0; z < extent.z; ++z) {
+			for (int y = 0; y < extent.y; ++y) {
+				for (int x = 0; x < extent.x; ++x) {
+					const glm::ivec3 voxel = min + glm::ivec3(x, y, z);
+					block[x + extent.x * (y + extent.y * z)] = channel ? coarse.gradient(voxel)[channel - 1] : coarse.value(voxel);
+				}
+			}
+		}
+
+		int i0[3][tile_width], i1[3][tile_width];
+		float t[3][tile_width];
+		for (int axis = 0; axis < 3; ++axis) {
+			for (int i = 0; i < tile_extent[axis]; ++i) {
+				glm::ivec3 voxel = tile_min;
+				voxel[axis] += i;
+				const double u = coarsePosition(voxel, scale, coarse.dimensions)[axis] - min[axis];
+				i0[axis][i] = std::min((int)u, extent[axis] - 1);
+				i1[axis][i] = std::min(i0[axis][i] + 1, extent[axis] - 1);
+				t[axis][i] = (float)(u - i0[axis][i]);
+			}
+		}
+
+		for (int z = 0; z < tile_extent.z; ++z) {
+			for (int y = 0; y < tile_extent.y; ++y) {
+				const float* p00 = block.data() + extent.x * (i0[1][y] + extent.y * i0[2][z]);
+				const float* p10 = block.data() + extent.x * (i1[1][y] + extent.y * i0[2][z]);
+				const float* p01 = block.data() + extent.x * (i0[1][y] + extent.y * i1[2][z]);
+				const float* p11 = block.data() + extent.x * (i1[1][y] + extent.y * i1[2][z]);
+				float* out = values + tile_width * (y + tile_size * z);
+				for (int x = 0; x < tile_extent.x; ++x) {
+					const int a = i0[0][x], b = i1[0][x];
+					const float c00 = glm::mix(p00[a], p00[b], t[0][x]);
+					const float c10 = glm::mix(p10[a], p10[b], t[0][x]);
+					const float c01 = glm::mix(p01[a], p01[b], t[0][x]);
+					const float c11 = glm::mix(p11[a], p11[b], t[0][x]);
+					out[x] = glm::mix(glm::mix(c00, c10, t[1][y]), glm::mix(c01, c11, t[1][y]), t[2][z]);
+				}
+			}
+		}
+	}
+
+	// Estimates how far linear interpolation between the voxels of each brick is off. Between two samples of f, the error is at most h^2 |f''| / 8,
+	// and the second difference f(x-h) - 2f(x) + f(x+h) approximates h^2 f''.
+	std::vector<float> brickErrors(const BrickMap& bricks) {
+		std::vector<float> errors(bricks.bricks.size());
+		flo::ThreadPool::global().parallelFor(bricks.bricks.size(), [&](uint brick) {
+			const glm::ivec3 min = bricks.brickMin(brick);
+			const glm::ivec3 max = bricks.brickMax(brick);
+
+			float error = 0.f;
+			for (int z = min.z; z < max.z; ++z) {
+				for (int y = min.y; y < max.y; ++y) {
+					for (int x = min.x; x < max.x; ++x) {
+						const glm::ivec3 voxel(x, y, z);
+						const float center = 2.f * bricks.value(voxel);
+						float sum = 0.f;
+						for (int axis = 0; axis < 3; ++axis) {
+							if (voxel[axis] == 0 || voxel[axis] == bricks.dimensions[axis] - 1) continue;
+							glm::ivec3 step(0);
+							step[axis] = 1;
+							sum += std::abs(bricks.value(voxel - step) - center + bricks.value(voxel + step));
+						}
+						error = std::max(error, sum * 0.125f);
+					}
+				}
+			}
+			errors[brick] = error;
+		});
+		return errors;
+	}
+
+	void Refinement::begin(CubeMap& map, const TileFunction& _evaluate, float _tolerance) {
+		cancel(map);
+
+		evaluate = _evaluate;
+		tolerance = _tolerance;
+		dimensions = glm::ivec3(map.texture.width, map.texture.height, map.texture.depth);
+		factor = coarse_factor;
+
+		pending.origin = map.origin;
+		pending.size = map.size;
+		pending.axes = map.axes;
+		pending.resize(levelDimensions(dimensions, factor));
+		pending.bricks.resize(levelDimensions(dimensions, factor));
+		pending.bricks.setChannels(map.bricks.channels);
+
+		std::vector<uint> tiles(TileGrid(pending).size());
+		for (uint tile = 0; tile < tiles.size(); ++tile) tiles[tile] = tile;
+		evaluate(pending, tiles, nullptr);
+
+		apply(map);
+		factor /= 2;
+		start(map);
+	}
+
+	bool Refinement::poll(CubeMap& map, bool wait) {
+		bool changed = false;
+		while (task.valid()) {
+			if (!wait && task.wait_for(std::chrono::seconds(0)) != std::future_status::ready) break;
+
+			task.get();
+			apply(map);
+			changed = true;
+
+			factor /= 2;
+			start(map);
+		}
+		return changed;
+	}
+
+	void Refinement::cancel(CubeMap& map) {
+		if (task.valid()) {
+			cancelled = true;
+			task.wait();
+		}
+		task = std::future<void>();
+		cancelled = false;
+
+		if (factor) {
+			map.resize(dimensions);
+			map.bricks.clear();
+		}
+		factor = 0;
+		evaluate = nullptr;
+	}
+
+	bool Refinement::active() const {
+		return factor != 0;
+	}
+
+	void Refinement::evaluateLevel(const CubeMap& previous) {
+		const TileGrid grid(pending);
+		const BrickMap& coarse = previous.bricks;
+		const glm::dvec3 scale = glm::dvec3(coarse.dimensions) / glm::dvec3(grid.dimensions);
+		const std::vector<float> errors = brickErrors(coarse);
+
+		// Coarse voxels that each tile interpolates between.
+		std::vector<glm::ivec3> coarse_min(grid.size()), coarse_max(grid.size());
+		std::vector<uint> evaluated, interpolated;
+		for (uint tile = 0; tile < grid.size(); ++tile) {
+			const glm::ivec3 min = glm::ivec3(coarsePosition(grid.tileMin(tile), scale, coarse.dimensions));
+			const glm::ivec3 max = glm::min(glm::ivec3(coarsePosition(grid.tileMax(tile) - 1, scale, coarse.dimensions)) + 1, coarse.dimensions - 1);
+			coarse_min[tile] = min;
+			coarse_max[tile] = max;
+
+			const glm::ivec3 first = min / brick_shape;
+			const glm::ivec3 last = max / brick_shape;
+			float error = 0.f;
+			bool empty = true;
+			for (int z = first.z; z <= last.z; ++z) {
+				for (int y = first.y; y <= last.y; ++y) {
+					for (int x = first.x; x <= last.x; ++x) {
+						const uint brick = x + coarse.brick_count.x * (y + coarse.brick_count.y * z);
+						error = std::max(error, errors[brick]);
+						empty = empty && !coarse.bricks[brick];
+					}
+				}
+			}
+
+			if (error >= tolerance) evaluated.push_back(tile);
+			else if (!empty) interpolated.push_back(tile);
+		}
+
+		if (cancelled) return;
+		evaluate(pending, evaluated, &cancelled);
+		if (cancelled) return;
+
+		forEachTile(interpolated.size(), [&](uint i) {
+			const uint tile = interpolated[i];
+			const glm::ivec3 min = grid.tileMin(tile);
+
+			std::vector<float> values(pending.bricks.channels * tile_voxels, 0.f);
+			for (int channel = 0; channel < pending.bricks.channels; ++channel) {
+				interpolateTile(coarse, scale, min, grid.tileMax(tile) - min, coarse_min[tile], coarse_max[tile], channel, values.data() + channel * tile_voxels);
+			}
+			pending.bricks.writeTile(tile, values.data(), pending.bricks.hasGradients() ? values.data() + tile_voxels : nullptr);
+		}, &cancelled);
+	}
+
+	void Refinement::apply(CubeMap& map) {
+		map.resize(pending.bricks.dimensions);
+		map.bricks = std::move(pending.bricks);
+		map.upload();
+	}
+
+	void Refinement::start(CubeMap& map) {
+		if (factor < 1) {
+			factor = 0;
+			evaluate = nullptr;
+			return;
+		}
+
+		pending.resize(levelDimensions(dimensions, factor));
+		pending.bricks.resize(levelDimensions(dimensions, factor));
+		pending.bricks.setChannels(map.bricks.channels);
+
+		// The map is only read until the level is applied, which happens on the calling thread.
+		task = std::async(std::launch::async, [this, &map]() {
+			evaluateLevel(map);
+		});
+	}
+}
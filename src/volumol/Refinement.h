@@ -0,0 +1,50 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <functional>
+#include <future>
+#include <atomic>
+
+#include "Orbital.h"
+
+namespace mol {
+	// Fills the given tiles of a map on the CPU, tile indices are those of a TileGrid of the map.
+	// If cancel is given, the remaining tiles may be skipped once it is set, the map is discarded then.
+	// Evaluation that reads settings should take them when the function is created, it may run on other threads later on.
+	typedef std::function<void(CubeMap& map, const std::vector<uint>& tiles, const std::atomic<bool>* cancel)> TileFunction;
+
+	// Generates a cubemap level by level for previews: A grid at 1/4 of the resolution is written right away, grids at 1/2 and full resolution
+	// follow on a background thread. Finer levels only evaluate the tiles where interpolating the previous level could be off by tolerance or more,
+	// the error is estimated from the second differences of the previous level. The other tiles are interpolated.
+	// With a tolerance of 0, every tile of the last level is evaluated and the result equals the direct evaluation.
+	struct Refinement {
+		TileFunction evaluate;
+		float tolerance = 0.f;
+		glm::ivec3 dimensions = glm::ivec3(0);
+		// Resolution divisor of the level that is being evaluated, 0 if there is none.
+		int factor = 0;
+		CubeMap pending;
+		std::future<void> task;
+		// Set by cancel() to stop the level in the background between tiles.
+		std::atomic<bool> cancelled = false;
+
+		// Writes the coarsest level into map, which must already have its final dimensions, origin and size.
+		void begin(CubeMap& map, const TileFunction& evaluate, float tolerance);
+
+		// Moves finished levels into map and starts the next one. If wait is set, all levels are finished first.
+		// Returns true if map changed.
+		bool poll(CubeMap& map, bool wait = false);
+
+		// Drops the remaining levels and resizes map back to its final dimensions without any values.
+		void cancel(CubeMap& map);
+
+		bool active() const;
+
+	private:
+		void evaluateLevel(const CubeMap& previous);
+
+		void apply(CubeMap& map);
+
+		void start(CubeMap& map);
+	};
+}
@@ -71,6 +71,24 @@ namespace mol {
 
 		uint cubemap_slice_count = 1;
 		bool cubemap_use_gpu = true;
+		bool cubemap_single_precision = false;
+		bool cubemap_separable = true;
+		bool cubemap_cache_aos = false;
+		bool cubemap_progressive = false;
+		bool cubemap_gradients = false;
+		// Lets the CPU threads evaluate part of each cubemap while the compute shaders evaluate the rest.
+		bool cubemap_hybrid = false;
+		// Aligns orbital and density cubemaps with the principal axes of the molecule and trims them to the screened extents of the basis functions.
+		bool cubemap_fit_axes = false;
+		// Evaluates only one side of the mirror planes of the molecule on the CPU and mirrors the rest.
+		bool cubemap_symmetry = false;
+		float cubemap_refine_tolerance = 0.f;
+		// Absolute error that screening may introduce into orbitals and densities, 0 keeps the fixed extents of basis functions.
+		float cubemap_tolerance = 0.f;
+		// 0 for the total density, 1 for alpha, 2 for beta and 3 for the spin density, see DensityChannel.
+		uint density_channel = 0;
+
+		uint thread_count = 0;
 
 		float arrow_thickness = 0.1;
 		float arrow_length_multiplier = 1.0;
@@ -0,0 +1,177 @@
+#include "Symmetry.h"
+
+#include "../logic/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mol {
+	const glm::ivec3 brick_shape = glm::ivec3(tile_width, tile_size, tile_size);
+
+	int Symmetry::count() const {
+		return (mirrors & 1) + (mirrors >> 1 & 1) + (mirrors >> 2 & 1);
+	}
+
+	Symmetry findSymmetry(const std::vector<Atom>& atoms, const glm::dmat3& axes) {
+		Symmetry result;
+		if (!atoms.size()) return result;
+
+		const glm::dmat3 inverse = glm::transpose(axes);
+		std::vector<glm::dvec3> positions;
+		for (const Atom& atom : atoms) {
+			positions.push_back(inverse * glm::dvec3(atom.position));
+			result.center += positions.back();
+		}
+		result.center /= (double)atoms.size();
+
+		for (int axis = 0; axis < 3; ++axis) {
+			bool symmetric = true;
+			for (uint i = 0; i < atoms.size() && symmetric; ++i) {
+				glm::dvec3 image = positions[i];
+				image[axis] = 2.0 * result.center[axis] - image[axis];
+
+				symmetric = false;
+				for (uint j = 0; j < atoms.size() && !symmetric; ++j) {
+					symmetric = atoms[j].Z == atoms[i].Z && glm::length(positions[j] - image) <= symmetry_tolerance;
+				}
+			}
+			if (symmetric) result.mirrors |= 1 << axis;
+		}
+		return result;
+	}
+
+	void verifySymmetry(Symmetry& symmetry, const std::function<double(const glm::dvec3&)>& value, const std::vector<glm::dvec3>& samples, double tolerance) {
+		if (!symmetry.mirrors) return;
+
+		std::vector<double> values(samples.size());
+		double largest = 0.0;
+		for (uint i = 0; i < samples.size(); ++i) {
+			values[i] = value(samples[i]);
+			largest = std::max(largest, std::abs(values[i]));
+		}
+		const double limit = tolerance + 1e-6 * largest;
+
+		for (int axis = 0; axis < 3; ++axis) {
+			if (!(symmetry.mirrors >> axis & 1)) continue;
+
+			bool even = true, odd = true;
+			for (uint i = 0; i < samples.size() && (even || odd); ++i) {
+				glm::dvec3 image = samples[i];
+				image[axis] = 2.0 * symmetry.center[axis] - image[axis];
+				const double mirrored = value(image);
+				if (std::abs(mirrored - values[i]) > limit) even = false;
+				if (std::abs(mirrored + values[i]) > limit) odd = false;
+			}
+
+			if (even) symmetry.characters[axis] = 1;
+			else if (odd) symmetry.characters[axis] = -1;
+			else symmetry.mirrors &= ~(1 << axis);
+		}
+	}
+
+	void centerBox(const Symmetry& symmetry, glm::dvec3& low, glm::dvec3& high) {
+		for (int axis = 0; axis < 3; ++axis) {
+			if (!(symmetry.mirrors >> axis & 1)) continue;
+			const double half = std::max(symmetry.center[axis] - low[axis], high[axis] - symmetry.center[axis]);
+			low[axis] = symmetry.center[axis] - half;
+			high[axis] = symmetry.center[axis] + half;
+		}
+	}
+
+	// Voxels from half on are mirror images along the mirrored axes.
+	glm::ivec3 uniqueExtent(const BrickMap& bricks, const Symmetry& symmetry) {
+		glm::ivec3 half = bricks.dimensions;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (symmetry.mirrors >> axis & 1) half[axis] = (bricks.dimensions[axis] + 1) / 2;
+		}
+		return half;
+	}
+
+	std::vector<uint> uniqueTiles(const BrickMap& bricks, const Symmetry& symmetry) {
+		const glm::ivec3 half = uniqueExtent(bricks, symmetry);
+
+		std::vector<uint> tiles;
+		for (uint brick = 0; brick < bricks.bricks.size(); ++brick) {
+			if (glm::all(glm::lessThan(bricks.brickMin(brick), half))) tiles.push_back(brick);
+		}
+		return tiles;
+	}
+
+	void mirrorBricks(BrickMap& bricks, const Symmetry& symmetry) {
+		if (!symmetry.mirrors) return;
+
+		const glm::ivec3 dimensions = bricks.dimensions;
+		const glm::ivec3 half = uniqueExtent(bricks, symmetry);
+
+		// Bricks beyond a plane are cleared, every brick whose images hold values is allocated. Bricks are only allocated here,
+		// so that filling them in parallel reads stable pointers.
+		std::vector<uint> targets;
+		for (uint brick = 0; brick < bricks.bricks.size(); ++brick) {
+			const glm::ivec3 min = bricks.brickMin(brick);
+			const glm::ivec3 max = bricks.brickMax(brick);
+			if (glm::all(glm::lessThanEqual(max, half))) continue;
+			if (!glm::all(glm::lessThan(min, half))) bricks.release(brick);
+			targets.push_back(brick);
+
+			// The images of the voxels of the brick lie within source_min and source_max.
+			glm::ivec3 source_min = min, source_max = max - 1;
+			for (int axis = 0; axis < 3; ++axis) {
+				if (max[axis] <= half[axis]) continue;
+				source_min[axis] = std::min(min[axis], dimensions[axis] - max[axis]);
+				source_max[axis] = std::min(max[axis], half[axis]) - 1;
+				if (min[axis] >= half[axis]) source_max[axis] = dimensions[axis] - 1 - min[axis];
+			}
+
+			const glm::ivec3 first = source_min / brick_shape;
+			const glm::ivec3 last = source_max / brick_shape;
+			bool occupied = false;
+			for (int z = first.z; z <= last.z && !occupied; ++z) {
+				for (int y = first.y; y <= last.y && !occupied; ++y) {
+					for (int x = first.x; x <= last.x && !occupied; ++x) {
+						occupied = bricks.bricks[x + bricks.brick_count.x * (y + bricks.brick_count.y * z)] != nullptr;
+					}
+				}
+			}
+			if (occupied) bricks.allocate(brick);
+		}
+
+		const int channels = bricks.channels;
+		flo::ThreadPool::global().parallelFor(targets.size(), [&](uint i) {
+			float* data = bricks.bricks[targets[i]].get();
+			if (!data) return;
+
+			const glm::ivec3 min = bricks.brickMin(targets[i]);
+			const glm::ivec3 max = bricks.brickMax(targets[i]);
+			for (int z = min.z; z < max.z; ++z) {
+				for (int y = min.y; y < max.y; ++y) {
+					for (int x = min.x; x < max.x; ++x) {
+						const glm::ivec3 voxel(x, y, z);
+						if (glm::all(glm::lessThan(voxel, half))) continue;
+
+						glm::ivec3 image = voxel;
+						float sign = 1.f;
+						glm::vec3 gradient_sign(1.f);
+						for (int axis = 0; axis < 3; ++axis) {
+							if (voxel[axis] < half[axis]) continue;
+							image[axis] = dimensions[axis] - 1 - voxel[axis];
+							sign *= (float)symmetry.characters[axis];
+							gradient_sign[axis] = -1.f;
+						}
+
+						float* out = data + channels * (x % tile_width + tile_width * (y % tile_size + tile_size * (z % tile_size)));
+						const float* source = bricks.bricks[bricks.brickIndex(image)].get();
+						if (!source) {
+							std::fill(out, out + channels, 0.f);
+							continue;
+						}
+						source += channels * (image.x % tile_width + tile_width * (image.y % tile_size + tile_size * (image.z % tile_size)));
+						out[0] = sign * source[0];
+						for (int c = 1; c < channels; ++c) out[c] = sign * gradient_sign[c - 1] * source[c];
+					}
+				}
+			}
+		});
+
+		bricks.compact();
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <functional>
+
+#include "BrickMap.h"
+#include "Molecule.h"
+
+namespace mol {
+	// Largest distance in Angstrom by which an atom may miss the mirror image of an atom of the same element.
+	constexpr double symmetry_tolerance = 1e-3;
+
+	// Mirror planes through center, each perpendicular to one axis of a cubemap. Once the grid is aligned with the symmetry axes,
+	// these are the mirror planes of D2h and of its subgroups like C2v, C2h and Cs, the rotations and the inversion follow from them.
+	struct Symmetry {
+		glm::dvec3 center = glm::dvec3(0.0);
+		// Bit i is set if the values are mirrored across the plane perpendicular to axis i.
+		int mirrors = 0;
+		// 1 if the values keep their sign across the plane perpendicular to axis i, -1 if they change it.
+		glm::ivec3 characters = glm::ivec3(1);
+
+		int count() const;
+	};
+
+	// Finds the planes through the centroid of the atoms, perpendicular to the columns of axes, that map every atom onto an atom of the same element.
+	// The center is given in the frame of axes.
+	Symmetry findSymmetry(const std::vector<Atom>& atoms, const glm::dmat3& axes);
+
+	// Drops the mirrors of symmetry across which value, a function of the position in the frame of the map, does not take the same or the opposite value
+	// at all samples, and sets the characters of the others. Deviations up to tolerance plus a millionth of the largest value are accepted.
+	void verifySymmetry(Symmetry& symmetry, const std::function<double(const glm::dvec3&)>& value, const std::vector<glm::dvec3>& samples, double tolerance);
+
+	// Widens the box so that its middle is the center along every mirrored axis, the voxels on both sides of each plane then mirror each other.
+	void centerBox(const Symmetry& symmetry, glm::dvec3& low, glm::dvec3& high);
+
+	// Tiles that hold voxels of the symmetry-unique part of the map, which lies on the lower side of every mirror plane.
+	std::vector<uint> uniqueTiles(const BrickMap& bricks, const Symmetry& symmetry);
+
+	// Fills all voxels beyond the mirror planes from their images on the lower side, once the tiles of uniqueTiles() are written.
+	// Values are multiplied by the characters of the planes they are reflected across, gradient components along those axes change their sign as well.
+	void mirrorBricks(BrickMap& bricks, const Symmetry& symmetry);
+}
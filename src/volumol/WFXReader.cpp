@@ -9,6 +9,7 @@
 
 namespace mol {
 	extern std::vector<ContractedBasis> basis_set;
+	extern std::vector<Shell> shells;
 	extern std::vector<MolecularOrbital> mos;
 }
 
@@ -69,6 +70,36 @@ namespace mol::WFX {
 		glm::ivec3(3, 2, 0), glm::ivec3(4, 0, 1), glm::ivec3(4, 1, 0), glm::ivec3(5, 0, 0)
 	};
 
+	// WFX files only list primitives. Consecutive primitives with the same center, exponent and l are grouped
+	// into shells, so that the radial part can be shared between them.
+	void groupShells() {
+		shells.clear();
+		for (uint i = 0; i < basis_set.size(); ++i) {
+			if (basis_set[i].gto_primitives.size() != 1) return;
+			const GTO& gto = basis_set[i].gto_primitives[0];
+			const int l = gto.e_x + gto.e_y + gto.e_z;
+
+			bool extend = shells.size();
+			if (extend) {
+				const Shell& shell = shells[shells.size() - 1];
+				extend = shell.origin == basis_set[i].origin && shell.l == l && shell.primitives[0].x == gto.e_r;
+				for (const std::vector<ShellTerm>& c : shell.components) {
+					if (c[0].e_x == gto.e_x && c[0].e_y == gto.e_y && c[0].e_z == gto.e_z) extend = false;
+				}
+			}
+			if (!extend) {
+				shells.push_back(Shell());
+				Shell& shell = shells[shells.size() - 1];
+				shell.origin = basis_set[i].origin;
+				shell.l = l;
+				shell.primitives.push_back(glm::dvec2(gto.e_r, gto.coeff));
+				shell.first_function = i;
+			}
+			Shell& shell = shells[shells.size() - 1];
+			shell.components.push_back(std::vector<ShellTerm>{ ShellTerm{ gto.e_x, gto.e_y, gto.e_z, gto.coeff / shell.primitives[0].y } });
+		}
+	}
+
 	void loadMOs() {
 		seekKeyWord("Number of Primitives");
 		if (endOfFile()) return;
@@ -159,6 +190,8 @@ namespace mol::WFX {
 				++index;
 			}
 		}
+
+		groupShells();
 		
 		seekKeyWord("Molecular Orbital Energies");
 		if (endOfFile()) {
@@ -253,6 +286,7 @@ namespace mol::WFX {
 			}
 			
 			mo->basis = &basis_set;
+			mo->shells = &shells;
 			mo->lcao_coefficients.resize(basis_set.size());
 
 			index = 0;
@@ -277,8 +311,11 @@ namespace mol::WFX {
 
 	void loadFile() {
 		molecule.atoms.clear();
+		cancelRefinement();
 		basis_set.clear();
+		shells.clear();
 		mos.clear();
+		clearAOCache();
 
 		seekKeyWord("Number of Nuclei");
 		if (endOfFile()) {
@@ -19,6 +19,11 @@ else:
 
 __library.pySetPath(ctypes.c_wchar_p(__VOLUMOL_PATH))
 
+DENSITY_TOTAL = 0
+DENSITY_ALPHA = 1
+DENSITY_BETA = 2
+DENSITY_SPIN = 3
+
 class Settings:
     size_factor = 0.2
     bond_thickness = 0.2
@@ -43,6 +48,8 @@ class Settings:
     clear_alpha = 1.0
     arrow_thickness = 0.1
     arrow_length_multiplier = 1.0
+    cubemap_refine_tolerance = 0.
+    cubemap_tolerance = 0.
 
     ambient_color = (0.4, 0.4, 0.4)
     sun_color = (2., 2., 2.)
@@ -58,6 +65,8 @@ class Settings:
     aa_quality = 1
     cubemap_slice_count = 1
     ao_iterations = 16
+    thread_count = 0
+    density_channel = DENSITY_TOTAL
 
     smooth_bonds = False
     premultiply_color = True
@@ -72,6 +81,14 @@ class Settings:
     enable_shadows = True
     sticky_sun = False
     black_bonds = False
+    cubemap_single_precision = False
+    cubemap_separable = True
+    cubemap_cache_aos = False
+    cubemap_progressive = False
+    cubemap_gradients = False
+    cubemap_hybrid = False
+    cubemap_fit_axes = False
+    cubemap_symmetry = False
 
 SPIN_UP = False
 SPIN_DOWN = True
@@ -175,6 +192,27 @@ def MOCubemap(orbital):
 def densityCubemap():
     __library.pyDensityCubemap()
 
+def evaluatePoints(points, orbitals=(), density=False, gradients=False, out=None):
+    import numpy
+    points = numpy.ascontiguousarray(points, dtype=numpy.float64).reshape(-1, 3)
+    shape = (len(points), len(orbitals) + (1 if density else 0), 4 if gradients else 1)
+    if out is None:
+        out = numpy.empty(shape, dtype=numpy.float32)
+    elif out.dtype != numpy.float32 or out.shape != shape or not out.flags["C_CONTIGUOUS"]:
+        raise ValueError("out must be a contiguous float32 array of shape " + str(shape))
+    orbital_array = (ctypes.c_int * len(orbitals))(*orbitals)
+    __library.pyEvaluatePoints(points.ctypes.data_as(ctypes.POINTER(ctypes.c_double)), ctypes.c_int(len(points)), orbital_array, ctypes.c_int(len(orbitals)),
+        ctypes.c_bool(density), ctypes.c_bool(gradients), out.ctypes.data_as(ctypes.POINTER(ctypes.c_float)))
+    return out
+
+def exportMOCubes(orbitals, paths, resolution=(0, 0, 0), origin=(0., 0., 0.), size=(0., 0., 0.)):
+    if len(paths) != len(orbitals):
+        raise ValueError("Expected one path per orbital, got " + str(len(paths)) + " paths for " + str(len(orbitals)) + " orbitals")
+    orbital_array = (ctypes.c_int * len(orbitals))(*orbitals)
+    path_array = (ctypes.c_char_p * len(paths))(*[path.encode("utf-8") for path in paths])
+    resolution_array = (ctypes.c_int * 3)(*resolution)
+    return __library.pyExportMOCubes(orbital_array, ctypes.c_int(len(orbitals)), path_array, ctypes.c_int(len(paths)), resolution_array, compressVec3(origin), compressVec3(size)) != 0
+
 def setIsosurface():
     __library.pySetIsosurface()
 
@@ -210,7 +248,7 @@ def removeBond(a,b):
     __library.pyRemoveBond(ctypes.c_int(a),ctypes.c_int(b))
 
 def updateSettings(settings):
-    floats = (ctypes.c_float * 23)(
+    floats = (ctypes.c_float * 25)(
         settings.size_factor, 
         settings.bond_thickness, 
         settings.bond_length_tolerance,
@@ -233,7 +271,9 @@ def updateSettings(settings):
         settings.volumetric_gradient,
         settings.clear_alpha,
         settings.arrow_thickness,
-        settings.arrow_length_multiplier
+        settings.arrow_length_multiplier,
+        settings.cubemap_refine_tolerance,
+        settings.cubemap_tolerance
     )
 
     vec3s = compressVec3(
@@ -245,7 +285,7 @@ def updateSettings(settings):
         settings.clear_color
     )
 
-    ints = (ctypes.c_int * 7)()
+    ints = (ctypes.c_int * 9)()
     ints[0] = settings.sphere_subdivisions
     ints[1] = settings.cylinder_resolution
     ints[2] = settings.volumetric_iterations
@@ -253,8 +293,10 @@ def updateSettings(settings):
     ints[4] = settings.aa_quality
     ints[5] = settings.cubemap_slice_count
     ints[6] = settings.ao_iterations
+    ints[7] = settings.thread_count
+    ints[8] = settings.density_channel
 
-    bools = (ctypes.c_bool * 13)(
+    bools = (ctypes.c_bool * 21)(
         settings.smooth_bonds,
         settings.premultiply_color,
         settings.cubemap_use_gpu,
@@ -267,7 +309,15 @@ def updateSettings(settings):
         settings.uniform_atom_sizes,
         settings.enable_shadows,
         settings.sticky_sun,
-        settings.black_bonds
+        settings.black_bonds,
+        settings.cubemap_single_precision,
+        settings.cubemap_separable,
+        settings.cubemap_cache_aos,
+        settings.cubemap_progressive,
+        settings.cubemap_gradients,
+        settings.cubemap_hybrid,
+        settings.cubemap_fit_axes,
+        settings.cubemap_symmetry
     )
 
     __library.pyUpdateSettings(floats, vec3s, ints, bools)